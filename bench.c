@@ -0,0 +1,367 @@
+//load generator : client threads over loopback drive one mread pool , the report is one json line
+//  -c connections (64) -t client threads (4) -s message size (64 , >= 8) -d seconds (2)
+//  -r messages per second of all the connections (0 : as fast as it goes) -B messages of one send when pipelined (16)
+//  -p pipeline | rr (request-response , the server echoes with mread_send)
+//  -e edge trigger -u io_uring -b ring buffer bytes -P port -y busy poll us -U unix socket path (instead of tcp)
+//the run fails (exit 1 , "valid":false) when a close of the clients isn't reported
+
+#include "mread.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//log linear histogram of ns , 16 buckets for each power of 2
+#define SUBBITS 4
+#define HISTOGRAM (64 << SUBBITS)
+
+struct bench {
+	int conns;
+	int threads;
+	int size;
+	int seconds;
+	int rate;
+	int burst;
+	int rr;
+	int edge_trigger;
+	int uring;
+	int buffer;
+	int port;
+	int busy_poll;
+	const char * path;
+	volatile int stop;
+	uint64_t deadline;
+	struct mread_pool * m;
+	int closed;
+	uint64_t msgs;
+	uint64_t bytes;
+	uint64_t histogram[HISTOGRAM];
+};
+
+struct client {
+	struct bench * b;
+	int index;
+	int n;
+	int * fd;
+};
+
+static uint64_t
+_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+_bucket(uint64_t v) {
+	if (v < (1 << SUBBITS)) {
+		return (int)v;
+	}
+	int msb = 63 - __builtin_clzll(v);
+	return ((msb - SUBBITS + 1) << SUBBITS) | (int)((v >> (msb - SUBBITS)) & ((1 << SUBBITS) - 1));
+}
+
+//the upper bound of a bucket
+static uint64_t
+_bucket_value(int index) {
+	if (index < (1 << SUBBITS)) {
+		return index;
+	}
+	int msb = (index >> SUBBITS) + SUBBITS - 1;
+	uint64_t sub = index & ((1 << SUBBITS) - 1);
+	return ((((uint64_t)1 << SUBBITS) | sub) + 1) << (msb - SUBBITS);
+}
+
+static double
+_percentile(struct bench * b, double p) {
+	uint64_t total = 0;
+	int i;
+	for (i=0;i<HISTOGRAM;i++) {
+		total += b->histogram[i];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(total * p);
+	uint64_t n = 0;
+	for (i=0;i<HISTOGRAM;i++) {
+		n += b->histogram[i];
+		if (n > rank) {
+			break;
+		}
+	}
+	return _bucket_value(i) / 1000.0;
+}
+
+//the server loop : pull whole messages , the first 8 bytes are the send time of the client
+static void *
+_server(void * ud) {
+	struct bench * b = ud;
+	struct mread_pool * m = b->m;
+	while (b->closed < b->conns) {
+		int id = mread_poll(m, 100);
+		if (id < 0) {
+            //every close must be reported , give up only to fail the run
+			if (b->stop && _now_ns() > b->deadline) {
+				break;
+			}
+			continue;
+		}
+		for (;;) {
+			char * buffer = mread_pull(m, b->size);
+			if (buffer == NULL) {
+				if (mread_closed(m)) {
+					++b->closed;
+				}
+				break;
+			}
+			uint64_t t;
+			memcpy(&t, buffer, sizeof(t));
+			++b->histogram[_bucket(_now_ns() - t)];
+			++b->msgs;
+			b->bytes += b->size;
+			if (b->rr) {
+				mread_send(m, id, buffer, b->size);
+			}
+			mread_yield(m);
+		}
+	}
+	return NULL;
+}
+
+static int
+_connect(struct bench * b) {
+	if (b->path) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		struct sockaddr_un un;
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strncpy(un.sun_path, b->path, sizeof(un.sun_path) - 1);
+		if (connect(fd, (struct sockaddr *)&un, sizeof(un)) == -1) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+	int port = b->port;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static int
+_write(int fd, const char * buffer, int size) {
+	while (size > 0) {
+		ssize_t n = send(fd, buffer, size, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buffer += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int
+_read(int fd, char * buffer, int size) {
+	while (size > 0) {
+		ssize_t n = recv(fd, buffer, size, 0);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		buffer += n;
+		size -= n;
+	}
+	return 0;
+}
+
+//round robin over the connections of the thread , paced to rate / threads
+static void *
+_client(void * ud) {
+	struct client * c = ud;
+	struct bench * b = c->b;
+	int burst = b->rr ? 1 : b->burst;
+	char * buffer = calloc(burst, b->size);
+	double rate = b->rate > 0 ? (double)b->rate / b->threads : 0;
+	uint64_t start = _now_ns();
+	uint64_t sent = 0;
+	int i = 0;
+	while (!b->stop) {
+		if (rate > 0) {
+			double due = (_now_ns() - start) / 1e9 * rate;
+			if (sent >= due) {
+				struct timespec ts = { 0, 100000 };
+				nanosleep(&ts, NULL);
+				continue;
+			}
+		}
+		uint64_t t = _now_ns();
+		int k;
+		for (k=0;k<burst;k++) {
+			memcpy(buffer + k * b->size, &t, sizeof(t));
+		}
+		int fd = c->fd[i];
+		if (_write(fd, buffer, burst * b->size) == -1) {
+			break;
+		}
+		if (b->rr && _read(fd, buffer, b->size) == -1) {
+			break;
+		}
+		sent += burst;
+		if (++i == c->n) {
+			i = 0;
+		}
+	}
+	for (i=0;i<c->n;i++) {
+		close(c->fd[i]);
+	}
+	free(buffer);
+	return NULL;
+}
+
+static void
+_usage(const char * name) {
+	fprintf(stderr, "usage: %s [-c conns] [-t threads] [-s size] [-d seconds] [-r rate] [-B burst] [-p pipeline|rr] [-e] [-u] [-b buffer] [-P port] [-y busy_poll] [-U path]\n", name);
+}
+
+int
+main(int argc, char * argv[]) {
+	static struct bench b;
+	b.conns = 64;
+	b.threads = 4;
+	b.size = 64;
+	b.seconds = 2;
+	b.burst = 16;
+	b.port = 20000 + getpid() % 10000;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:t:s:d:r:B:p:eub:P:y:U:")) != -1) {
+		switch (opt) {
+		case 'c': b.conns = atoi(optarg); break;
+		case 't': b.threads = atoi(optarg); break;
+		case 's': b.size = atoi(optarg); break;
+		case 'd': b.seconds = atoi(optarg); break;
+		case 'r': b.rate = atoi(optarg); break;
+		case 'B': b.burst = atoi(optarg); break;
+		case 'p': b.rr = strcmp(optarg, "rr") == 0; break;
+		case 'e': b.edge_trigger = 1; break;
+		case 'u': b.uring = 1; break;
+		case 'b': b.buffer = atoi(optarg); break;
+		case 'P': b.port = atoi(optarg); break;
+		case 'y': b.busy_poll = atoi(optarg); break;
+		case 'U': b.path = optarg; break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (b.size < 8 || b.conns <= 0 || b.threads <= 0 || b.burst <= 0) {
+		_usage(argv[0]);
+		return 1;
+	}
+	if (b.threads > b.conns) {
+		b.threads = b.conns;
+	}
+
+	struct mread_option mopt;
+	memset(&mopt, 0, sizeof(mopt));
+	mopt.edge_trigger = b.edge_trigger;
+	mopt.backend = b.uring ? MREAD_BACKEND_URING : MREAD_BACKEND_POLL;
+	mopt.backlog = b.conns;
+	mopt.busy_poll = b.busy_poll;
+	b.m = mread_create_option(b.path ? -1 : b.port, b.conns, b.buffer, &mopt);
+	if (b.m == NULL || (b.path && mread_listen(b.m, b.path, 0, 0) < 0)) {
+		if (b.path) {
+			fprintf(stderr, "can't listen on %s\n", b.path);
+		} else {
+			fprintf(stderr, "can't listen on port %d\n", b.port);
+		}
+		return 1;
+	}
+
+	struct client * c = calloc(b.threads, sizeof(*c));
+	int i;
+	for (i=0;i<b.threads;i++) {
+		c[i].b = &b;
+		c[i].index = i;
+		c[i].fd = malloc(b.conns * sizeof(int));
+	}
+	for (i=0;i<b.conns;i++) {
+		int fd = _connect(&b);
+		if (fd < 0) {
+			fprintf(stderr, "can't connect to %s\n", b.path ? b.path : "the port");
+			return 1;
+		}
+		struct client * cc = &c[i % b.threads];
+		cc->fd[cc->n++] = fd;
+	}
+
+	pthread_t server;
+	pthread_create(&server, NULL, _server, &b);
+	pthread_t * client = malloc(b.threads * sizeof(pthread_t));
+	uint64_t start = _now_ns();
+	for (i=0;i<b.threads;i++) {
+		pthread_create(&client[i], NULL, _client, &c[i]);
+	}
+	sleep(b.seconds);
+	b.deadline = _now_ns() + (uint64_t)5 * 1000000000;
+	b.stop = 1;
+	for (i=0;i<b.threads;i++) {
+		pthread_join(client[i], NULL);
+	}
+	pthread_join(server, NULL);
+	double seconds = (_now_ns() - start) / 1e9;
+
+	struct mread_stats st;
+	mread_stats(b.m, &st);
+	uint64_t syscalls = st.wait + st.recv + st.send + st.accept;
+	int valid = b.closed == b.conns;
+	printf("{\"valid\":%s,\"pattern\":\"%s\",\"transport\":\"%s\",\"backend\":\"%s\",\"edge_trigger\":%d,\"conns\":%d,\"threads\":%d,\"size\":%d,"
+		"\"rate\":%d,\"seconds\":%.3f,\"msgs\":%llu,\"msgs_per_sec\":%.0f,\"mb_per_sec\":%.2f,"
+		"\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"syscalls_per_msg\":%.3f,"
+		"\"closed\":%d,\"wait\":%llu,\"recv\":%llu,\"send\":%llu,\"collect\":%llu,\"pause\":%llu,\"copy\":%llu,\"buffer_peak\":%d,"
+		"\"busy_poll\":%d,\"spin_hit\":%llu,\"spin_us\":%llu,\"sleep_us\":%llu}\n",
+		valid ? "true" : "false", b.rr ? "rr" : "pipeline", b.path ? "unix" : "tcp", b.uring ? "io_uring" : "poll", b.edge_trigger, b.conns, b.threads, b.size,
+		b.rate, seconds, (unsigned long long)b.msgs, b.msgs / seconds, b.bytes / seconds / (1024 * 1024),
+		_percentile(&b, 0.5), _percentile(&b, 0.99), _percentile(&b, 0.999),
+		b.msgs ? (double)syscalls / b.msgs : 0, b.closed,
+		(unsigned long long)st.wait, (unsigned long long)st.recv, (unsigned long long)st.send,
+		(unsigned long long)st.collect, (unsigned long long)st.pause, (unsigned long long)st.copy, st.buffer_peak,
+		b.busy_poll, (unsigned long long)st.spin_hit, (unsigned long long)st.spin_us, (unsigned long long)st.sleep_us);
+
+	mread_close(b.m);
+	for (i=0;i<b.threads;i++) {
+		free(c[i].fd);
+	}
+	free(c);
+	free(client);
+	if (!valid) {
+		fprintf(stderr, "%d of %d closes reported\n", b.closed, b.conns);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,366 @@
+//micro benchmark of the ring buffer : the calls of mread timed in batches under a size distribution and a fill level ,
+//one json line for each run
+//  -d small | bimodal | uniform | all (default) : the bytes of each recv , and of each pull
+//  -f fill levels (0.1,0.3) : pulls consume the whole data of a connection while the buffer is fuller than it.
+//     with 2k reads the allocs stepping over in use blocks collect before it's much fuller , used is the real one
+//  -b ring buffer bytes (1M) -n connections (1024) -o recvs of each run (1000000)
+//  -p oldest | largest | priority : the collect policy
+//expand_ns is ringbuffer_expand with the shrink after it (a recv appended to the tail)
+
+#include "ringbuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <getopt.h>
+
+#define READSIZE 2048
+#define BATCH 32
+
+enum {
+	OP_ALLOC,
+	OP_SHRINK,
+	OP_LINK,
+	OP_EXPAND,
+	OP_DATA,
+	OP_COPY,
+	OP_YIELD,
+	OP_FREE,
+	OP_COLLECT,
+	OP_MAX,
+};
+
+static const char * op_name[OP_MAX] = {
+	"alloc", "shrink", "link", "expand", "data", "copy", "yield", "free", "collect",
+};
+
+struct conn {
+	struct ringbuffer_block * node;
+	struct ringbuffer_block * tail;
+	int bytes;
+};
+
+struct run {
+	struct ringbuffer * rb;
+	struct conn * conn;
+	int conns;
+	int dist;
+	int buffer;
+	double fill;
+	int timing;
+	uint64_t ns[OP_MAX];
+	uint64_t count[OP_MAX];
+	uint64_t contiguous;
+	uint64_t used;      //sum of the bytes in use after each timed round
+	int rounds;
+};
+
+static const char * dist_name[] = { "small", "bimodal", "uniform" };
+
+static uint64_t
+_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//small messages , mostly small with some near a mtu , or anything up to a read block
+static int
+_size(int dist) {
+	switch (dist) {
+	case 0:
+		return 16 + rand() % 113;
+	case 1:
+		return rand() % 10 ? 64 : 1400;
+	default:
+		return 1 + rand() % READSIZE;
+	}
+}
+
+static void
+_count(struct run * r, int op, uint64_t ns, int n) {
+	if (r->timing) {
+		r->ns[op] += ns;
+		r->count[op] += n;
+	}
+}
+
+//the blocks of the victim are released by collect already
+static int
+_collect(struct run * r) {
+	uint64_t t = _now_ns();
+	int id = ringbuffer_collect(r->rb);
+	uint64_t ns = _now_ns() - t;
+	_count(r, OP_COLLECT, ns, 1);
+	if (id >= 0) {
+		struct conn * c = &r->conn[id];
+		c->node = NULL;
+		c->tail = NULL;
+		c->bytes = 0;
+	}
+	return id;
+}
+
+//alloc , then collect until it fits as mread does. the time of collect is not counted in alloc
+static struct ringbuffer_block *
+_alloc(struct run * r, int size, uint64_t * collect_ns) {
+	struct ringbuffer_block * blk;
+	while ((blk = ringbuffer_alloc(r->rb, size)) == NULL) {
+		uint64_t t = _now_ns();
+		int id = _collect(r);
+		*collect_ns += _now_ns() - t;
+		if (id < 0)
+			return NULL;
+	}
+	return blk;
+}
+
+//recvs into new blocks for random connections : alloc , shrink to the bytes received , link to the tail
+static void
+_recv(struct run * r) {
+	int id[BATCH];
+	int size[BATCH];
+	struct ringbuffer_block * blk[BATCH];
+	int i;
+	for (i=0;i<BATCH;i++) {
+		id[i] = rand() % r->conns;
+		size[i] = _size(r->dist);
+	}
+	uint64_t collect_ns = 0;
+	uint64_t t = _now_ns();
+	for (i=0;i<BATCH;i++) {
+		blk[i] = _alloc(r, READSIZE, &collect_ns);
+	}
+	uint64_t t1 = _now_ns();
+	_count(r, OP_ALLOC, t1 - t - collect_ns, BATCH);
+	for (i=0;i<BATCH;i++) {
+		if (blk[i]) {
+			ringbuffer_shrink(r->rb, blk[i], size[i]);
+		}
+	}
+	uint64_t t2 = _now_ns();
+	_count(r, OP_SHRINK, t2 - t1, BATCH);
+	int last = -1;
+	for (i=0;i<BATCH;i++) {
+		if (blk[i] == NULL)
+			continue;
+		struct conn * c = &r->conn[id[i]];
+		if (c->node) {
+			ringbuffer_link(r->rb, c->tail, blk[i]);
+		} else {
+			ringbuffer_own(r->rb, blk[i], id[i]);
+			c->node = blk[i];
+		}
+		c->tail = blk[i];
+		c->bytes += size[i];
+		last = id[i];
+	}
+	_count(r, OP_LINK, _now_ns() - t2, BATCH);
+	if (last < 0)
+		return;
+
+	//the last block is just before head , more recvs of its connection grow it in place
+	struct conn * c = &r->conn[last];
+	for (i=0;i<BATCH/4;i++) {
+		size[i] = _size(r->dist);
+	}
+	int n = 0;
+	t = _now_ns();
+	for (i=0;i<BATCH/4;i++) {
+		int length = c->tail->length - sizeof(struct ringbuffer_block);
+		if (ringbuffer_expand(r->rb, c->tail, READSIZE) == NULL)
+			break;
+		ringbuffer_shrink(r->rb, c->tail, length + size[i]);
+		c->bytes += size[i];
+		++n;
+	}
+	_count(r, OP_EXPAND, _now_ns() - t, n);
+}
+
+//pull a message from random connections : data , copy when it's not continuous , then yield.
+//the whole data is yielded while the buffer is fuller than the fill level
+static void
+_pull(struct run * r) {
+	int id[BATCH];
+	int size[BATCH];
+	void * ptr[BATCH];
+	struct ringbuffer_block * temp[BATCH];
+	int i;
+	for (i=0;i<BATCH;i++) {
+		id[i] = rand() % r->conns;
+		int bytes = r->conn[id[i]].bytes;
+		int sz = _size(r->dist);
+		size[i] = sz < bytes ? sz : bytes;
+		temp[i] = NULL;
+	}
+	uint64_t t = _now_ns();
+	int n = 0;
+	for (i=0;i<BATCH;i++) {
+		struct conn * c = &r->conn[id[i]];
+		if (size[i] > 0) {
+			ringbuffer_data(r->rb, c->node, size[i], 0, &ptr[i]);
+			++n;
+		}
+	}
+	_count(r, OP_DATA, _now_ns() - t, n);
+
+	uint64_t collect_ns = 0;
+	for (i=0;i<BATCH;i++) {
+		if (size[i] == 0)
+			continue;
+		if (ptr[i]) {
+			if (r->timing) {
+				++r->contiguous;
+			}
+		} else {
+			temp[i] = _alloc(r, size[i], &collect_ns);
+		}
+	}
+	//a collect may take a connection to copy from , give its temp back
+	for (i=0;i<BATCH;i++) {
+		if (temp[i] && r->conn[id[i]].node == NULL) {
+			ringbuffer_shrink(r->rb, temp[i], 0);
+			temp[i] = NULL;
+		}
+	}
+	t = _now_ns();
+	n = 0;
+	for (i=0;i<BATCH;i++) {
+		if (temp[i]) {
+			ringbuffer_copy(r->rb, r->conn[id[i]].node, 0, temp[i]);
+			++n;
+		}
+	}
+	uint64_t t1 = _now_ns();
+	_count(r, OP_COPY, t1 - t, n);
+	for (i=0;i<BATCH;i++) {
+		if (temp[i]) {
+			ringbuffer_free(r->rb, temp[i]);
+		}
+	}
+	uint64_t t2 = _now_ns();
+	_count(r, OP_FREE, t2 - t1, n);
+
+	struct ringbuffer_stats st;
+	ringbuffer_stats(r->rb, &st);
+	int full = st.used > r->fill * r->buffer;
+	if (r->timing) {
+		r->used += st.used;
+		++r->rounds;
+	}
+	t = _now_ns();
+	n = 0;
+	for (i=0;i<BATCH;i++) {
+		struct conn * c = &r->conn[id[i]];
+		int sz = full || size[i] > c->bytes ? c->bytes : size[i];
+		if (sz == 0)
+			continue;
+		c->node = ringbuffer_yield(r->rb, c->node, sz);
+		c->bytes -= sz;
+		if (c->node == NULL) {
+			c->tail = NULL;
+		}
+		++n;
+	}
+	_count(r, OP_YIELD, _now_ns() - t, n);
+}
+
+static void
+_run(int dist, double fill, int buffer, int conns, int recvs, int policy) {
+	struct run r;
+	memset(&r, 0, sizeof(r));
+	r.rb = ringbuffer_new(buffer);
+	ringbuffer_policy(r.rb, policy);
+	r.conn = calloc(conns, sizeof(struct conn));
+	r.conns = conns;
+	r.dist = dist;
+	r.buffer = buffer;
+	r.fill = fill;
+	int rounds = recvs / BATCH;
+	int i;
+	for (i=0;i<rounds;i++) {
+        //the first tenth fills the buffer up , not timed
+		r.timing = i >= rounds / 10;
+		_recv(&r);
+		_pull(&r);
+	}
+	struct ringbuffer_stats st;
+	ringbuffer_stats(r.rb, &st);
+	int free_run, free_max;
+	ringbuffer_free_runs(r.rb, &free_run, &free_max);
+	printf("{\"dist\":\"%s\",\"fill\":%.2f,\"buffer\":%d,\"conns\":%d", dist_name[dist], fill, buffer, conns);
+	for (i=0;i<OP_MAX;i++) {
+		printf(",\"%s_ns\":%.1f", op_name[i], r.count[i] ? (double)r.ns[i] / r.count[i] : 0);
+	}
+	printf(",\"recvs\":%llu,\"expands\":%llu,\"copies\":%llu,\"collects\":%llu,\"contiguous\":%.3f,\"used\":%.3f,\"peak\":%d,\"free_run\":%d}\n",
+		(unsigned long long)r.count[OP_ALLOC], (unsigned long long)r.count[OP_EXPAND],
+		(unsigned long long)r.count[OP_COPY], (unsigned long long)r.count[OP_COLLECT],
+		r.count[OP_DATA] ? (double)r.contiguous / r.count[OP_DATA] : 0,
+		r.rounds ? (double)r.used / r.rounds / buffer : 0, st.peak, free_run);
+	free(r.conn);
+	ringbuffer_delete(r.rb);
+}
+
+static void
+_usage(const char * name) {
+	fprintf(stderr, "usage: %s [-d small|bimodal|uniform|all] [-f fill,...] [-b buffer] [-n conns] [-o recvs] [-p oldest|largest|priority]\n", name);
+}
+
+int
+main(int argc, char * argv[]) {
+	int dist = -1;
+	const char * fill = "0.1,0.3";
+	int buffer = 1024 * 1024;
+	int conns = 1024;
+	int recvs = 1000000;
+	int policy = RINGBUFFER_COLLECT_OLDEST;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:f:b:n:o:p:")) != -1) {
+		switch (opt) {
+		case 'd':
+			for (dist=0;dist<3;dist++) {
+				if (strcmp(optarg, dist_name[dist]) == 0)
+					break;
+			}
+			if (dist == 3) {
+				dist = -1;
+			}
+			break;
+		case 'f': fill = optarg; break;
+		case 'b': buffer = atoi(optarg); break;
+		case 'n': conns = atoi(optarg); break;
+		case 'o': recvs = atoi(optarg); break;
+		case 'p':
+			policy = strcmp(optarg, "largest") == 0 ? RINGBUFFER_COLLECT_LARGEST :
+				strcmp(optarg, "priority") == 0 ? RINGBUFFER_COLLECT_PRIORITY : RINGBUFFER_COLLECT_OLDEST;
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (buffer < READSIZE * BATCH || conns <= 0) {
+		_usage(argv[0]);
+		return 1;
+	}
+	srand(1);
+	int d;
+	for (d=0;d<3;d++) {
+		if (dist >= 0 && d != dist)
+			continue;
+		const char * f = fill;
+		while (*f) {
+			char * end;
+			double level = strtod(f, &end);
+			if (end == f) {
+				_usage(argv[0]);
+				return 1;
+			}
+			_run(d, level, buffer, conns, recvs, policy);
+			f = *end == ',' ? end + 1 : end;
+		}
+	}
+	return 0;
+}
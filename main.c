@@ -3,6 +3,11 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#ifdef MREAD_TRACE
+#include "mreadtrace.h"
+#include <signal.h>
+#endif
+
 static void
 test(struct mread_pool *m) {
 	int id = mread_poll(m,0); 	//id of socket
@@ -27,6 +32,9 @@ test(struct mread_pool *m) {
 
 int
 main() {
+#ifdef MREAD_TRACE
+	mread_trace_signal(SIGUSR1);        //kill -USR1 to dump the trace ring
+#endif
 	struct mread_pool * m = mread_create(2525 , 10, 0);
 	if (m == NULL) {
 		perror("error:");
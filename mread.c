@@ -1,9 +1,10 @@
-#include "mread.h"
-#include "ringbuffer.h"
-
 /* Test for polling API */
 #ifdef __linux__
 #define HAVE_EPOLL 1
+#define HAVE_ACCEPT4 1
+#define HAVE_IO_URING 1
+#define HAVE_SPLICE 1
+#define _GNU_SOURCE
 #endif
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
@@ -15,28 +16,64 @@
 #endif
 /* ! Test for polling API */
 
+#include "mread.h"
+#include "mreadlog.h"
+#include "ringbuffer.h"
+#include "timerwheel.h"
+
 #ifdef HAVE_EPOLL
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #elif HAVE_KQUEUE
 #include <sys/event.h>
 #endif
 
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
-#include <stdio.h>
 #include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <poll.h>
 
 #define BACKLOG 32
+#define ACCEPTBUDGET 64
 #define READQUEUE 32
 #define READBLOCKSIZE 2048
+#define DRAINBLOCK 16
 #define RINGBUFFER_DEFAULT 1024 * 1024
+#define RINGBUFFER_IDLE 10000
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define URING_BUFFERS 256
+#define URING_PENDING 16
+#define SENDCHUNK 4096
+#define SENDFREE 64
+#define SENDVEC 64
+#define FORWARDSIZE 65536
+#define CACHELINE 64
+//datagram sockets : max datagrams of one recvmmsg , and max bytes of the block it reads into
+#define DGRAMBATCH 32
+#define DGRAMBLOCK 131072
+#define DGRAMSIZE 2048
+//max segments the kernel coalesces into one gro datagram (UDP_GRO_CNT_MAX)
+#define DGRAMGROSEGS 64
+#define DGRAMGROSIZE 65535
 
 
 //socket status
@@ -48,80 +85,298 @@
 
 #define SOCKET_ALIVE	SOCKET_SUSPEND
 
-//cast ~0 to intptr_t , intptr was introduced in c99, hold all pointer
-#define LISTENSOCKET (void *)((intptr_t)~0)
+//socket not in the drain list
+#define DRAIN_NONE -2
+//socket not in the pause list
+#define PAUSE_NONE -2
+//socket not in the flush list
+#define FLUSH_NONE -2
+//socket not in the close list
+#define CLOSE_NONE -2
+
+//the event data of listener i is ~i , intptr was introduced in c99, hold all pointer. it's never a socket address
+#define MAXLISTENER 16
+#define LISTENSOCKET(i) ((void *)~(intptr_t)(i))
+#define LISTENINDEX(p) ((int)~(intptr_t)(p))
+#define ISLISTENSOCKET(p) ((uintptr_t)(p) >= (uintptr_t)LISTENSOCKET(MAXLISTENER - 1))
+//the event data of the span release wakeup , below the listeners
+#define WAKESOCKET LISTENSOCKET(MAXLISTENER)
+
+//io_uring user data which is not (version << 32 | socket index) , listener i accepts with URING_LISTEN - i
+#define URING_CANCEL ((uint64_t)~0)
+#define URING_LISTEN ((uint64_t)~1)
+#define ISURINGLISTEN(ud) ((ud) <= URING_LISTEN && (ud) > URING_LISTEN - MAXLISTENER)
+#define URING_WAKE (URING_LISTEN - MAXLISTENER)
+//io_uring poll for POLLOUT , the bit is set in the socket index of the user data
+#define URING_POLLOUT 0x80000000u
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//mread_forward : the data of the socket goes to fd through a pipe by splice
+struct forward {
+	int fd;          //a dup of the fd of mread_forward , it's registered for EPOLLOUT on its own
+	int pipe[2];
+	int pipe_bytes;  //spliced in , not out yet
+	int flags;
+	int eof;
+	int blocked;     //fd is full , the read event of the socket is off
+	int registered;
+};
+
+//per connection timeouts , they are allocated with the timer wheel
+struct deadline {
+	uint64_t recv;                   //last data received
+	uint64_t read;                   //data buffered and nothing pulled since , 0 if it's all pulled
+	int idle_timeout;
+	int read_timeout;
+};
+
+//output queued by mread_send , the data follows the struct
+struct wchunk {
+	struct wchunk * next;
+	int cap;
+	int head;    //bytes sent
+	int tail;    //bytes queued
+};
+
+//a message taken out by mread_detach , its block is pinned until the last release
+struct span {
+	struct mread_span span;
+	struct ringbuffer_block * blk;
+	struct mread_pool * pool;
+	int ref;
+	struct span * next;
+};
 
-//socket
+//socket , the fields poll and pull touch fill the first cache line , the array is aligned to it.
+//the counters of mread_socket_stats are kept aside (socket_stat of the pool) , a pull never writes the second line
 struct socket {
-	int fd;
 	struct ringbuffer_block * node;
+	struct ringbuffer_block * tail;  //last block of node , it grows in place while it's the last allocated one
 	struct ringbuffer_block * temp;
+	struct forward * forward;        //the data is forwarded , not handed to the user
 	int status;
+	int fd;                          //-1 while the socket is free
+	unsigned version;                //bump for each client, drop stale completions and handles
+	int drain_next;                  //next index in the drain list
+	int pending;                     //io_uring : completions buffered since the last pull ran dry
+	int frame_max;
+	char frame_header;               //bytes of the length prefix of a frame , 0 if it's not framed
+	char frame_big_endian;
+	char drain;                      //edge trigger : kernel may still hold data for it
+	char batch;                      //handed out by the current mread_poll_batch
+	char paused;                     //io_uring : recv cancelled until the buffered data is pulled
+                                     //epoll/kqueue : read events disabled by backpressure
+	char armed;                      //io_uring : multishot recv in flight
+	char datagram;                   //udp : DGRAM_* , each datagram is a frame in the ring buffer
+	char eof;                        //io_uring : peer closed , close it when the buffered data runs out
+    //cold
+	struct wchunk * whead;           //output queue
+	struct wchunk * wtail;
+	int pause_next;                  //next index in the pause list
+	int free_next;                   //next index in the free list
+	int flush_next;                  //next index in the flush list
+	int close_next;                  //next index in the close list
+	int held_head;                   //io_uring : provided buffers held back by backpressure , -1 if none
+	int held_tail;
+	char wait_out;                   //the kernel buffer is full , EPOLLOUT (EVFILT_WRITE , io_uring poll) armed
+	char listener;                   //the index of the listener it was accepted by
+} __attribute__((aligned(CACHELINE)));
+
+_Static_assert(offsetof(struct socket, whead) == CACHELINE && sizeof(struct socket) == CACHELINE * 2,
+	"the hot fields of struct socket fill the first cache line");
+
+
+#define DGRAM_ON 1
+#define DGRAM_SOURCE 2
+#define DGRAM_GRO 4
+
+//a listen socket , tcp v4 / v6 , unix stream , or one bound by someone else
+struct listener {
+	int fd;
+	int budget;                      //max accept per listen event
+	char * path;                     //unix socket file bound by the pool , removed by mread_close
+};
+
+#ifdef HAVE_IO_URING
+//a provided buffer held back , in the list of its socket
+struct uring_held {
+	int next;
+	int size;
 };
+#endif
 
 //pool
 struct mread_pool {
 
-	int listen_fd;
+	struct listener listener[MAXLISTENER];
+	int listener_count;
+	int backlog;
+	int reuseport;
 #ifdef HAVE_EPOLL
 	int epoll_fd;
 #elif HAVE_KQUEUE
 	int kqueue_fd;
 #endif
 	int max_connection;
+	int accept_budget;               //the default of the listeners
+	struct mread_stats stat;         //counters, ring buffer fields are filled by mread_stats
+    //closed sockets not reported dry yet , in the order of close. the ones freed since are skipped when they reach the head
 	int closed;
+	int close_head;
+	int close_tail;
 	int active;                      //number of currently using socket
 	int skip;
 	struct socket * sockets;
-	struct socket * free_socket;
+	struct mread_socket_stats * socket_stat;
+    //free sockets , a freed one goes to the tail so an id is reused as late as possible
+	int free_head;
+	int free_tail;
     //length and head of kernel queue
 	int queue_len;
 	int queue_head;
+	int queue_max;
+    //sockets with output to send before the next wait , and the free output chunks
+	int flush_head;
+	struct wchunk * wfree;
+	int wfree_count;
+    //spans released by the workers (pushed by any thread , taken all at once by the poll thread) , and the free ones
+	struct span * span_released;
+	struct span * span_free;
+	int span_count;                  //spans not reclaimed yet
+    //a release into the empty list wakes the poll thread , set up by the first detach
+	int wake;
+#ifdef HAVE_EPOLL
+	int wake_fd;                     //eventfd
+#endif
+#ifdef HAVE_IO_URING
+	int wake_armed;                  //a read of wake_fd is submitted
+	uint64_t wake_value;
+#endif
+    //ids of the last mread_poll_batch
+	int * batch;
+	int batch_len;
+	int batch_cap;
+	int edge_trigger;
+    //sockets need to be re-drained without a new event (edge trigger)
+	int drain_head;
+	int drain_tail;
+	int drain_count;
+	int drain_round;
+    //backpressure : stop reading new data below low_free bytes of free space , resume above high_free
+	int backpressure;
+	int low_free;
+	int high_free;
+	int pause_head;
+	int pause_count;
+	int pause_space;                 //free space of the last pause , resume only when something is released since
+    //length prefixed frames , the default of the new connections
+	int frame_header;
+	int frame_big_endian;
+	int frame_max;
+    //growable ring buffer : the free segments at its end are given back every buffer_idle ms , 0 if it's fixed
+	int buffer_idle;
+	uint64_t release_time;
+    //the memory of the ring buffer is placed by the first wait , on the node of the polling thread
+	int place_pending;
+	int populate;                    //0 , 1 fault in , 2 lock
+    //timeouts : one timer for each connection , it's set to the nearest deadline it may have and checked when it
+    //expires , so the data received doesn't touch the wheel. NULL until a timeout is set
+	struct timerwheel * timer;
+	struct deadline * deadline;
+	uint64_t now;                    //ms , taken once for each wait
+	int idle_timeout;                //the default of new connections
+	int read_timeout;
+    //busy poll : spin with non-blocking waits for up to busy_poll us before blocking , while the mean time to the
+    //next event (spin_gap , us) is shorter than that
+	int busy_poll;
+	int busy_socket;
+	int spin_gap;
+	int datagram_max;                //max payload of a datagram (of one gro datagram with MREAD_UDP_GRO)
 
 #ifdef HAVE_EPOLL
-	struct epoll_event ev[READQUEUE];
+	struct epoll_event * ev;
 #elif HAVE_KQUEUE
-	struct kevent ev[READQUEUE];     //event
+	struct kevent * ev;              //event
 #endif
 	struct ringbuffer * rb;          //ring buffer
+#ifdef HAVE_IO_URING
+	struct uring * uring;            //io_uring backend, NULL for epoll
+	struct uring_held * held;        //for each provided buffer held back , the next one of its socket and its size
+#endif
 };
 
 //create socket
 static struct socket *
 _create_sockets(int max) {
 
-    printf("create sockets \n");
+	MREAD_DEBUG("create sockets %d\n", max);
 
 	int i;
-	struct socket * s = malloc(max * sizeof(struct socket));
+	struct socket * s;
+	if (posix_memalign((void **)&s, CACHELINE, max * sizeof(struct socket))) {
+		return NULL;
+	}
 	for (i=0;i<max;i++) {             //make self sockets a linkedlist
-		s[i].fd = i+1;
+		s[i].fd = -1;
+		s[i].free_next = i+1;
 		s[i].node = NULL;
 		s[i].temp = NULL;
+		s[i].tail = NULL;
 		s[i].status = SOCKET_INVALID;
+		s[i].drain = 0;
+		s[i].drain_next = DRAIN_NONE;
+		s[i].eof = 0;
+		s[i].armed = 0;
+		s[i].paused = 0;
+		s[i].pause_next = PAUSE_NONE;
+		s[i].pending = 0;
+		s[i].batch = 0;
+		s[i].whead = NULL;
+		s[i].wtail = NULL;
+		s[i].flush_next = FLUSH_NONE;
+		s[i].close_next = CLOSE_NONE;
+		s[i].wait_out = 0;
+		s[i].held_head = -1;
+		s[i].held_tail = -1;
+		s[i].forward = NULL;
+		s[i].version = 0;
 	}
-	s[max-1].fd = -1;                 //todo  ?
-
-    int j;
-    for(j=0;j<max;j++){
-        printf("fd of s [%d] is %d \n",j,s[j].fd);
-    }
+	s[max-1].free_next = -1;          //end of the free list
 
 	return s;
 }
 
 //create ring buffer
 static struct ringbuffer *
-_create_rb(int size) {
+_create_rb(int size, int max, int segment, int hugepage) {
 	size = (size + 3) & ~3;
 	if (size < READBLOCKSIZE * 2) {
 		size = READBLOCKSIZE * 2;
 	}
-	struct ringbuffer * rb = ringbuffer_new(size);
+	if (segment > 0 && segment < READBLOCKSIZE * 2) {
+		segment = READBLOCKSIZE * 2;
+	}
+	int flags = hugepage == MREAD_HUGEPAGE_HUGETLB ? RINGBUFFER_HUGETLB : hugepage ? RINGBUFFER_HUGEPAGE : 0;
+	struct ringbuffer * rb = ringbuffer_new_memory(size, max, segment, flags);
 
 	return rb;
 }
 
+//bind the ring buffer to a numa node (-1 : the one of this thread) , then fault it in or lock it , in this order
+//so the pages are placed on the node
+static void
+_place_rb(struct mread_pool * self, int numa, int node) {
+	if (numa != MREAD_NUMA_NONE && ringbuffer_bind(self->rb, node) == -1) {
+		MREAD_INFO("MREAD can't bind the ring buffer to numa node %d\n", node);
+	}
+	if (self->populate && ringbuffer_populate(self->rb, self->populate == 2) == -1) {
+		MREAD_ERROR("MREAD can't lock the ring buffer (RLIMIT_MEMLOCK) , fault it in\n");
+	}
+}
+
 //release ring buffer
 static void
 _release_rb(struct ringbuffer * rb) {
@@ -140,84 +395,175 @@ _set_nonblocking(int fd)
 	return fcntl(fd, F_SETFL, flag | O_NONBLOCK);
 }
 
-//create pool
-//init socket
-//init kqueue
-//init self
-struct mread_pool *
-mread_create(int port , int max , int buffer_size) {
-    //get fd
-	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (listen_fd == -1) {
-		return NULL;
+#ifdef HAVE_IO_URING
+
+static void
+_uring_accept(struct uring * ur, int listen_fd, int index) {
+	struct io_uring_sqe * sqe = uring_sqe(ur);
+	if (sqe == NULL) {
+		return;
 	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listen_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = URING_LISTEN - index;
+}
 
-    //set non block
-	if ( -1 == _set_nonblocking(listen_fd) ) {
-		return NULL;
+//the provided buffers are what the kernel may have in flight , they take a quarter of the ring buffer at most.
+//with backpressure they stay below the low watermark , the room a pull which needs more data may take.
+//a power of 2 up to URING_BUFFERS , 0 if the ring buffer is too small for one
+static int
+_uring_buffers(struct mread_pool * self) {
+	int limit = ringbuffer_space(self->rb) / 4;
+	if (self->backpressure && limit >= self->low_free) {
+		limit = self->low_free - 1;
+	}
+	int count = URING_BUFFERS;
+	while (count > 0 && count * READBLOCKSIZE > limit) {
+		count /= 2;
 	}
+	return count;
+}
 
-    //set reuse
-	int reuse = 1;
-	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int));
+//io_uring with a provided buffer ring , the listeners arm their multishot accept when they are added
+static int
+_create_uring(struct mread_pool * self) {
+	int count = _uring_buffers(self);
+	if (count == 0) {
+		return -1;
+	}
+	self->held = malloc(count * sizeof(struct uring_held));
+	self->uring = uring_new(URING_ENTRIES, URING_CQ_ENTRIES);
+	if (self->uring == NULL) {
+		return -1;
+	}
+	if (uring_buffer_init(self->uring, 0, count, READBLOCKSIZE) == -1) {
+		return -1;
+	}
+	return 0;
+}
 
-    //init host,port
-	struct sockaddr_in my_addr;
-	memset(&my_addr, 0, sizeof(struct sockaddr_in));
-	my_addr.sin_family = AF_INET;
-	my_addr.sin_port = htons(port);
-	my_addr.sin_addr.s_addr = htonl(INADDR_ANY); // INADDR_LOOPBACK
+//multishot recv picking buffers from the buffer ring, user data tells socket and its version
+static int
+_uring_recv(struct mread_pool * self, struct socket * s, int fd) {
+	struct io_uring_sqe * sqe = uring_sqe(self->uring);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = (uint64_t)s->version << 32 | (uint64_t)(s - self->sockets);
+	s->armed = 1;
+	return 0;
+}
 
-	printf("MREAD bind %s:%u\n",inet_ntoa(my_addr.sin_addr),ntohs(my_addr.sin_port));
+static void
+_uring_cancel(struct mread_pool * self, struct socket * s) {
+	struct io_uring_sqe * sqe = uring_sqe(self->uring);
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (uint64_t)s->version << 32 | (uint64_t)(s - self->sockets);
+	sqe->user_data = URING_CANCEL;
+}
 
-    //bind
-	if (bind(listen_fd, (struct sockaddr *)&my_addr, sizeof(struct sockaddr)) == -1) {
-		close(listen_fd);
-		return NULL;
+//the socket is closed , give its held buffers back to the kernel
+static void
+_uring_unhold_drop(struct mread_pool * self, struct socket * s) {
+	while (s->held_head >= 0) {
+		int bid = s->held_head;
+		s->held_head = self->held[bid].next;
+		uring_buffer_recycle(self->uring, bid);
 	}
-    //listen
-	if (listen(listen_fd, BACKLOG) == -1) {
-		close(listen_fd);
-		return NULL;
+	s->held_tail = -1;
+}
+
+//one shot poll for POLLOUT , the output is flushed again when it completes
+static int
+_uring_pollout(struct mread_pool * self, struct socket * s) {
+	struct io_uring_sqe * sqe = uring_sqe(self->uring);
+	if (sqe == NULL) {
+		return -1;
 	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = s->fd;
+	sqe->poll32_events = POLLOUT;
+	sqe->user_data = (uint64_t)s->version << 32 | URING_POLLOUT | (uint64_t)(s - self->sockets);
+	return 0;
+}
 
-#ifdef HAVE_EPOLL
-	int epoll_fd = epoll_create(max + 1);
-	if (epoll_fd == -1) {
-		close(listen_fd);
-		return NULL;
+//read the eventfd of the span release wakeup , submitted again after each completion
+static void
+_uring_wake(struct mread_pool * self) {
+	struct io_uring_sqe * sqe = uring_sqe(self->uring);
+	if (sqe == NULL) {
+		return;
 	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = self->wake_fd;
+	sqe->addr = (uint64_t)(uintptr_t)&self->wake_value;
+	sqe->len = sizeof(self->wake_value);
+	sqe->user_data = URING_WAKE;
+	self->wake_armed = 1;
+}
 
-	struct epoll_event ev;
-	ev.events = EPOLLIN;
-	ev.data.ptr = LISTENSOCKET;
+static int _uring_read_queue(struct mread_pool * self, int timeout);
 
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == -1) {
-		close(listen_fd);
-		close(epoll_fd);
+#endif
+
+//create pool
+//init socket
+//init kqueue
+//init self
+struct mread_pool *
+mread_create(int port , int max , int buffer_size) {
+	return mread_create_option(port, max, buffer_size, NULL);
+}
+
+//opt can be NULL, zero fields take the defaults
+struct mread_pool *
+mread_create_option(int port , int max , int buffer_size , const struct mread_option * opt) {
+	struct mread_option default_opt;
+	if (opt == NULL) {
+		memset(&default_opt, 0, sizeof(default_opt));
+		opt = &default_opt;
+	}
+#ifdef HAVE_EPOLL
+	int epoll_fd = epoll_create(max + 1);
+	if (epoll_fd == -1) {
 		return NULL;
 	}
 #elif HAVE_KQUEUE
 	int kqueue_fd = kqueue();	//init kqueue
 	if (kqueue_fd == -1) {
-		close(listen_fd);
 		return NULL;
 	}
+#endif
 
-	struct kevent ke;	//init kevent
-	EV_SET(&ke, listen_fd, EVFILT_READ, EV_ADD, 0, 0, LISTENSOCKET);	//initializing a kevent structure
-
-    //first register, register change to triger , no event
-	if (kevent(kqueue_fd, &ke, 1, NULL, 0, NULL) == -1) {
-		close(listen_fd);
+	if (buffer_size == 0) {
+		buffer_size = RINGBUFFER_DEFAULT;
+	}
+#ifndef HAVE_IO_URING
+	if (opt->backend != MREAD_BACKEND_POLL) {
+#ifdef HAVE_EPOLL
+		close(epoll_fd);
+#elif HAVE_KQUEUE
 		close(kqueue_fd);
+#endif
 		return NULL;
 	}
 #endif
 
     //init self
 	struct mread_pool * self = malloc(sizeof(*self));
-	self->listen_fd = listen_fd;
+	self->listener_count = 0;
+	self->backlog = opt->backlog > 0 ? opt->backlog : BACKLOG;
+	self->reuseport = opt->reuseport;
 
 #ifdef HAVE_EPOLL
 	self->epoll_fd = epoll_fd;
@@ -225,26 +571,376 @@ mread_create(int port , int max , int buffer_size) {
 	self->kqueue_fd = kqueue_fd;
 #endif
 	self->max_connection = max;
+	memset(&self->stat, 0, sizeof(self->stat));
+	self->accept_budget = opt->accept_budget > 0 ? opt->accept_budget : ACCEPTBUDGET;
 	self->closed = 0;
+	self->close_head = -1;
+	self->close_tail = -1;
 	self->active = -1;
 	self->skip = 0;
 	self->sockets = _create_sockets(max);            //create sockets
-	self->free_socket = &self->sockets[0];           //free socket(could be used) is the first of sockets available
-
-    printf("fd of free socket is %d \n",self->free_socket->fd);
+	self->socket_stat = calloc(max, sizeof(struct mread_socket_stats));
+	self->free_head = 0;                             //free socket(could be used) is the first of sockets available
+	self->free_tail = max - 1;
 
 	self->queue_len = 0;
 	self->queue_head = 0;
-	if (buffer_size == 0) {
-		self->rb = _create_rb(RINGBUFFER_DEFAULT);   //create ring buffer
-	} else {
-		self->rb = _create_rb(buffer_size);
+	self->queue_max = opt->read_queue > 0 ? opt->read_queue : READQUEUE;
+	self->ev = malloc(self->queue_max * sizeof(self->ev[0]));
+	self->flush_head = -1;
+	self->wfree = NULL;
+	self->wfree_count = 0;
+	self->span_released = NULL;
+	self->span_free = NULL;
+	self->span_count = 0;
+	self->wake = 0;
+#ifdef HAVE_EPOLL
+	self->wake_fd = -1;
+#endif
+#ifdef HAVE_IO_URING
+	self->wake_armed = 0;
+#endif
+	self->batch = NULL;
+	self->batch_len = 0;
+	self->batch_cap = 0;
+	self->edge_trigger = opt->edge_trigger;
+	self->drain_head = -1;
+	self->drain_tail = -1;
+	self->drain_count = 0;
+	self->drain_round = 0;
+	self->rb = _create_rb(buffer_size, opt->buffer_max, opt->buffer_segment, opt->buffer_hugepage);   //create ring buffer
+	self->populate = opt->buffer_lock ? 2 : opt->buffer_prefault ? 1 : 0;
+	self->place_pending = opt->buffer_numa == MREAD_NUMA_POLL;
+	if (!self->place_pending) {
+		_place_rb(self, opt->buffer_numa, opt->buffer_node);
+	}
+	self->buffer_idle = 0;
+	self->release_time = 0;
+	if (opt->buffer_max > buffer_size) {
+		self->buffer_idle = opt->buffer_idle > 0 ? opt->buffer_idle : RINGBUFFER_IDLE;
+	}
+	ringbuffer_policy(self->rb, opt->collect);
+	self->backpressure = opt->backpressure;
+	int space = ringbuffer_space(self->rb);
+	self->low_free = opt->low_watermark > 0 ? opt->low_watermark : space / 8;
+	self->high_free = opt->high_watermark > 0 ? opt->high_watermark : space / 4;
+	if (self->high_free < self->low_free) {
+		self->high_free = self->low_free;
+	}
+	self->pause_head = -1;
+	self->pause_count = 0;
+	self->frame_header = 0;
+	mread_frame(self, -1, opt->frame_header, opt->frame_big_endian, opt->frame_max);
+	self->timer = NULL;
+	self->deadline = NULL;
+	self->now = 0;
+	mread_timeout(self, -1, opt->idle_timeout, opt->read_timeout);
+	self->busy_poll = opt->busy_poll;
+	self->busy_socket = opt->busy_poll_socket;
+	self->spin_gap = 0;
+	self->datagram_max = opt->datagram_max > 0 ? opt->datagram_max : DGRAMSIZE;
+	self->pause_space = 0;
+#ifdef HAVE_IO_URING
+	self->uring = NULL;
+	self->held = NULL;
+	if (opt->backend == MREAD_BACKEND_URING && _create_uring(self) == -1) {
+		mread_close(self);
+		return NULL;
 	}
+#endif
 
+	if ((opt->idle_timeout > 0 || opt->read_timeout > 0) && self->timer == NULL) {
+		mread_close(self);
+		return NULL;
+	}
+	if (port >= 0 && mread_listen(self, NULL, port, 0) < 0) {
+		mread_close(self);
+		return NULL;
+	}
 	return self;
 }
 
+//connect to the socket file : 1 if nobody listens on it (ECONNREFUSED) , 0 if a server does or it's unknown
+static int
+_unix_stale(const struct sockaddr * addr, socklen_t len) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return 0;
+	}
+    //a full backlog of a live server fails with EAGAIN instead of blocking
+	_set_nonblocking(fd);
+	int stale = connect(fd, addr, len) == -1 && errno == ECONNREFUSED;
+	close(fd);
+	return stale;
+}
+
+//socket , reuse , bind and listen , return the fd or -1
+static int
+_bind_listen(struct mread_pool * self, int family, const struct sockaddr * addr, socklen_t len) {
+    //get fd
+	int listen_fd = socket(family, SOCK_STREAM, 0);
+	if (listen_fd == -1) {
+		return -1;
+	}
+	fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+    //set reuse
+	int reuse = 1;
+	if (family != AF_UNIX) {
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int));
+	}
+
+    //several pools can share the port, the kernel shards incoming connections between them
+	if (self->reuseport && family != AF_UNIX) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(int)) == -1) {
+			close(listen_fd);
+			return -1;
+		}
+#else
+		close(listen_fd);
+		return -1;
+#endif
+	}
+    //a v6 listener takes v6 only , so a v4 one can share the port
+	if (family == AF_INET6) {
+		setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &reuse, sizeof(int));
+	}
+
+    //bind
+	if (bind(listen_fd, addr, len) == -1) {
+		close(listen_fd);
+		return -1;
+	}
+    //listen
+	if (listen(listen_fd, self->backlog) == -1) {
+		close(listen_fd);
+		return -1;
+	}
+	return listen_fd;
+}
+
+//listen on addr : NULL or "*" for any v4 address , an ipv6 address (with ':' , "::" for any) , or a unix socket
+//path (starting with '/' or '.' , '@' for the linux abstract namespace , port is ignored). return the index of the
+//listener , or -1
+int
+mread_listen(struct mread_pool * self, const char * addr, int port, int budget) {
+	int fd;
+	char * path = NULL;
+	if (addr && (addr[0] == '/' || addr[0] == '.' || addr[0] == '@')) {
+		struct sockaddr_un un;
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		size_t n = strlen(addr);
+		if (n >= sizeof(un.sun_path)) {
+			return -1;
+		}
+		memcpy(un.sun_path, addr, n);
+		socklen_t len = sizeof(un);
+		if (addr[0] == '@') {
+#ifdef __linux__
+			un.sun_path[0] = '\0';
+			len = offsetof(struct sockaddr_un, sun_path) + n;
+#else
+			return -1;
+#endif
+		} else {
+            //a socket file left by the last run , never another file , nor the socket of a live server
+			struct stat st;
+			if (lstat(addr, &st) == 0 && S_ISSOCK(st.st_mode)) {
+				if (_unix_stale((struct sockaddr *)&un, len) == 0) {
+					return -1;
+				}
+				unlink(addr);
+			}
+			path = strdup(addr);
+		}
+		MREAD_INFO("MREAD bind unix %s\n", addr);
+		fd = _bind_listen(self, AF_UNIX, (struct sockaddr *)&un, len);
+	} else if (addr && strchr(addr, ':')) {
+		struct sockaddr_in6 in6;
+		memset(&in6, 0, sizeof(in6));
+		in6.sin6_family = AF_INET6;
+		in6.sin6_port = htons(port);
+		if (inet_pton(AF_INET6, addr, &in6.sin6_addr) != 1) {
+			return -1;
+		}
+		MREAD_INFO("MREAD bind [%s]:%d\n", addr, port);
+		fd = _bind_listen(self, AF_INET6, (struct sockaddr *)&in6, sizeof(in6));
+	} else {
+        //init host,port
+		struct sockaddr_in my_addr;
+		memset(&my_addr, 0, sizeof(struct sockaddr_in));
+		my_addr.sin_family = AF_INET;
+		my_addr.sin_port = htons(port);
+		my_addr.sin_addr.s_addr = htonl(INADDR_ANY); // INADDR_LOOPBACK
+		if (addr && strcmp(addr, "*") != 0 && inet_pton(AF_INET, addr, &my_addr.sin_addr) != 1) {
+			return -1;
+		}
+		MREAD_INFO("MREAD bind %s:%u\n",inet_ntoa(my_addr.sin_addr),ntohs(my_addr.sin_port));
+		fd = _bind_listen(self, AF_INET, (struct sockaddr *)&my_addr, sizeof(my_addr));
+	}
+	if (fd < 0) {
+		free(path);
+		return -1;
+	}
+	int index = mread_listen_fd(self, fd, budget);
+	if (index < 0) {
+		close(fd);
+		if (path) {
+			unlink(path);
+			free(path);
+		}
+		return -1;
+	}
+	self->listener[index].path = path;
+	return index;
+}
+
+//add a socket already listening (inherited from a supervisor) , the pool owns it then. return the index or -1
+int
+mread_listen_fd(struct mread_pool * self, int fd, int budget) {
+	if (self->listener_count >= MAXLISTENER) {
+		return -1;
+	}
+    //set non block
+	if ( -1 == _set_nonblocking(fd) ) {
+		return -1;
+	}
+	int index = self->listener_count;
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+        //io_uring accepts by itself, the epoll set stays empty
+		_uring_accept(self->uring, fd, index);
+	} else
+#endif
+	{
+#ifdef HAVE_EPOLL
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = LISTENSOCKET(index);
+		if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			return -1;
+		}
+#elif HAVE_KQUEUE
+		struct kevent ke;	//init kevent
+		EV_SET(&ke, fd, EVFILT_READ, EV_ADD, 0, 0, LISTENSOCKET(index));	//initializing a kevent structure
+		if (kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL) == -1) {
+			return -1;
+		}
+#endif
+	}
+	struct listener * l = &self->listener[index];
+	l->fd = fd;
+	l->budget = budget > 0 ? budget : self->accept_budget;
+	l->path = NULL;
+	++self->listener_count;
+	return index;
+}
+
+//the listener id was accepted by , -1 if it's not in use
+int
+mread_listener(struct mread_pool * self, int id) {
+	if (id < 0 || id >= self->max_connection || self->sockets[id].status < SOCKET_ALIVE || self->sockets[id].datagram) {
+		return -1;
+	}
+	return self->sockets[id].listener;
+}
+
+//output chunks of SENDCHUNK bytes are kept in a free list , a larger send gets its own chunk
+static struct wchunk *
+_wchunk_new(struct mread_pool * self, int size) {
+	struct wchunk * c;
+	if (size <= SENDCHUNK && self->wfree) {
+		c = self->wfree;
+		self->wfree = c->next;
+		--self->wfree_count;
+	} else {
+		int cap = size > SENDCHUNK ? size : SENDCHUNK;
+		c = malloc(sizeof(*c) + cap);
+		c->cap = cap;
+	}
+	c->next = NULL;
+	c->head = 0;
+	c->tail = 0;
+	return c;
+}
+
+static void
+_wchunk_delete(struct mread_pool * self, struct wchunk * c) {
+	if (c->cap == SENDCHUNK && self->wfree_count < SENDFREE) {
+		c->next = self->wfree;
+		self->wfree = c;
+		++self->wfree_count;
+	} else {
+		free(c);
+	}
+}
+
+static void
+_wqueue_clear(struct mread_pool * self, struct socket * s) {
+	while (s->whead) {
+		struct wchunk * c = s->whead;
+		s->whead = c->next;
+		_wchunk_delete(self, c);
+	}
+	s->wtail = NULL;
+}
+
+//fill the last chunk first , so small sends are coalesced
+static void
+_wqueue(struct mread_pool * self, struct socket * s, const char * data, int size) {
+	struct wchunk * c = s->wtail;
+	if (c) {
+		int room = c->cap - c->tail;
+		if (room > size) {
+			room = size;
+		}
+		memcpy((char *)(c + 1) + c->tail, data, room);
+		c->tail += room;
+		data += room;
+		size -= room;
+	}
+	if (size > 0) {
+		c = _wchunk_new(self, size);
+		memcpy(c + 1, data, size);
+		c->tail = size;
+		if (s->wtail) {
+			s->wtail->next = c;
+		} else {
+			s->whead = c;
+		}
+		s->wtail = c;
+	}
+}
+
+static void
+_flush_push(struct mread_pool * self, struct socket * s) {
+	if (s->flush_next == FLUSH_NONE) {
+		s->flush_next = self->flush_head;
+		self->flush_head = s - self->sockets;
+	}
+}
 
+//unpin the blocks of the spans released since , return the number of them
+static int
+_span_reclaim(struct mread_pool * self) {
+	if (__atomic_load_n(&self->span_released, __ATOMIC_RELAXED) == NULL) {
+		return 0;
+	}
+	struct span * sp = __atomic_exchange_n(&self->span_released, NULL, __ATOMIC_ACQUIRE);
+	int n = 0;
+	while (sp) {
+		struct span * next = sp->next;
+		ringbuffer_unpin(self->rb, sp->blk);
+		sp->next = self->span_free;
+		self->span_free = sp;
+		sp = next;
+		++n;
+	}
+	self->span_count -= n;
+	return n;
+}
 
 //close pool
 void
@@ -259,11 +955,35 @@ mread_close(struct mread_pool *self) {
 		if (s[i].status >= SOCKET_ALIVE) {
 			close(s[i].fd);
 		}
+		_wqueue_clear(self, &s[i]);
+	}
+	while (self->wfree) {
+		struct wchunk * c = self->wfree;
+		self->wfree = c->next;
+		free(c);
+	}
+	_span_reclaim(self);
+	while (self->span_free) {
+		struct span * sp = self->span_free;
+		self->span_free = sp->next;
+		free(sp);
+	}
+#ifdef HAVE_EPOLL
+	if (self->wake_fd >= 0) {
+		close(self->wake_fd);
 	}
+#endif
 
 	free(s);
-	if (self->listen_fd >= 0) {
-		close(self->listen_fd);
+	free(self->socket_stat);
+	free(self->ev);
+	free(self->batch);
+	for (i=0;i<self->listener_count;i++) {
+		close(self->listener[i].fd);
+		if (self->listener[i].path) {
+			unlink(self->listener[i].path);
+			free(self->listener[i].path);
+		}
 	}
 #ifdef HAVE_EPOLL
 	close(self->epoll_fd);
@@ -271,24 +991,40 @@ mread_close(struct mread_pool *self) {
 	close(self->kqueue_fd);
 #endif
 	_release_rb(self->rb);
+	timerwheel_delete(self->timer);
+	free(self->deadline);
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		uring_delete(self->uring);
+	}
+	free(self->held);
+#endif
 	free(self);
 }
 
+static void _woken(struct mread_pool * self);
+
 //return number of events
 static int
 _read_queue(struct mread_pool * self, int timeout) {
 
 	self->queue_head = 0;
 
-#ifdef HAVE_EPOLL
-	int n = epoll_wait(self->epoll_fd , self->ev, READQUEUE, timeout);
-#elif HAVE_KQUEUE
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		return _uring_read_queue(self, timeout);
+	}
+#endif
+
+#ifdef HAVE_EPOLL
+	int n = epoll_wait(self->epoll_fd , self->ev, self->queue_max, timeout);
+#elif HAVE_KQUEUE
 	struct timespec timeoutspec;
 	timeoutspec.tv_sec = timeout / 1000;
 	timeoutspec.tv_nsec = (timeout % 1000) * 1000000;
 
     //second register , just register event , change registered above
-	int n = kevent(self->kqueue_fd, NULL, 0, self->ev, READQUEUE, &timeoutspec);
+	int n = kevent(self->kqueue_fd, NULL, 0, self->ev, self->queue_max, &timeoutspec);
 #endif
 	if (n == -1) {
 		self->queue_len = 0;
@@ -298,18 +1034,43 @@ _read_queue(struct mread_pool * self, int timeout) {
 	return n;
 }
 
-//return data, a socket struct
+//return data, a socket struct. a write event puts the socket to the flush list
 inline static struct socket *
 _read_one(struct mread_pool * self) {
 
-	if (self->queue_head >= self->queue_len) {             // queue is empty or reach the end, todo, will head exceed len?
-		return NULL;
-	}
+	while (self->queue_head < self->queue_len) {
 #ifdef HAVE_EPOLL
-	return self->ev[self->queue_head ++].data.ptr;
+		struct epoll_event * e = &self->ev[self->queue_head ++];
+		if (e->data.ptr == WAKESOCKET) {
+			uint64_t v;
+			if (read(self->wake_fd, &v, sizeof(v)) == sizeof(v)) {
+				_woken(self);
+			}
+			continue;
+		}
+		if (e->events & EPOLLOUT) {
+			struct socket * s = e->data.ptr;
+			_flush_push(self, s);
+            //a forwarded socket also gets the write event of its fd
+			if (!(e->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && s->forward == NULL) {
+				continue;
+			}
+		}
+		return e->data.ptr;
 #elif HAVE_KQUEUE
-	return self->ev[self->queue_head ++].udata;            //get data of event
+		struct kevent * e = &self->ev[self->queue_head ++];
+		if (e->filter == EVFILT_USER) {
+			_woken(self);
+			continue;
+		}
+		if (e->filter == EVFILT_WRITE) {
+			_flush_push(self, e->udata);
+			continue;
+		}
+		return e->udata;                                   //get data of event
 #endif
+	}
+	return NULL;
 }
 
 
@@ -317,192 +1078,1576 @@ _read_one(struct mread_pool * self) {
 static struct socket *
 _alloc_socket(struct mread_pool * self) {
 
-    printf("alloc socket... \n");
-
-	if (self->free_socket == NULL) {
+	if (self->free_head < 0) {
 		return NULL;
 	}
-	struct socket * s = self->free_socket;
+	struct socket * s = &self->sockets[self->free_head];
+
+	MREAD_DEBUG("alloc socket %d, next free %d\n", self->free_head, s->free_next);
+
+	self->free_head = s->free_next;                        //shift free socket to next one
+	if (self->free_head < 0) {
+		self->free_tail = -1;
+	}
+
+	return s;
+}
+
+//put back a socket just taken by _alloc_socket , at the head
+static void
+_free_socket(struct mread_pool * self, struct socket * s) {
+	int index = s - self->sockets;
+	s->free_next = self->free_head;
+	self->free_head = index;
+	if (self->free_tail < 0) {
+		self->free_tail = index;
+	}
+}
+
+//watch the client for reading
+static int
+_register_client(struct mread_pool * self, struct socket * s, int fd) {
+	++s->version;
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		return _uring_recv(self, s, fd);
+	}
+#endif
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+	ev.events = self->edge_trigger ? EPOLLIN | EPOLLET : EPOLLIN;
+	ev.data.ptr = s;
+	return epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+#elif HAVE_KQUEUE
+	struct kevent ke;
+	EV_SET(&ke, fd, EVFILT_READ, self->edge_trigger ? EV_ADD | EV_CLEAR : EV_ADD, 0, 0, s);
+	return kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL);        //register change for socket
+#endif
+}
 
-	int next_free = s->fd;                                 //fd point to next socket,fd of s [0] is 1 ,fd of s [1] is 2
+static uint64_t
+_now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
+static uint64_t
+_now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-    printf("next_free is %d \n",next_free);
+//return -1 when out of memory , the timers stay off
+static int
+_timer_init(struct mread_pool * self) {
+	if (self->timer == NULL) {
+		struct deadline * deadline = calloc(self->max_connection, sizeof(struct deadline));
+		if (deadline == NULL) {
+			return -1;
+		}
+		self->now = _now_ms();
+		self->timer = timerwheel_new(self->max_connection, self->now);
+		if (self->timer == NULL) {
+			free(deadline);
+			return -1;
+		}
+		self->deadline = deadline;
+	}
+	return 0;
+}
 
-	if (next_free < 0 ) {
-		self->free_socket = NULL;
+//the timer goes to the nearest deadline a connection may have from now on , a read deadline starts later than now
+//and the idle one moves later
+static void
+_timer_set(struct mread_pool * self, int id) {
+	struct deadline * d = &self->deadline[id];
+	int t = d->idle_timeout;
+	if (d->read_timeout > 0 && (t <= 0 || d->read_timeout < t)) {
+		t = d->read_timeout;
+	}
+	if (t > 0) {
+		timerwheel_add(self->timer, id, self->now + t);
 	} else {
-		self->free_socket = &self->sockets[next_free];     //shift free socket to next one
+		timerwheel_del(self->timer, id);
 	}
+}
 
-	return s;
+static void
+_timer_start(struct mread_pool * self, struct socket * s) {
+	struct deadline * d = &self->deadline[s - self->sockets];
+	d->recv = self->now;
+	d->read = s->node ? self->now : 0;
+	_timer_set(self, s - self->sockets);
 }
 
-//add client, assign fd to a free socket,which is a struct
+//data arrived , the idle clock restarts and the read clock starts unless it's running
+static void
+_received(struct mread_pool * self, struct socket * s, int bytes) {
+	self->stat.bytes += bytes;
+	self->socket_stat[s - self->sockets].bytes += bytes;
+	if (self->deadline) {
+		struct deadline * d = &self->deadline[s - self->sockets];
+		d->recv = self->now;
+		if (d->read == 0) {
+			d->read = self->now;
+		}
+	}
+}
+
+//let the blocking reads of the socket busy poll the device queue for usec , and prefer busy polling to the softirq
+//(linux 5.11+). more than net.core.busy_read needs CAP_NET_ADMIN , a failure is ignored
 static void
-_add_client(struct mread_pool * self, int fd) {
+_busy_socket(int fd, int usec) {
+#ifdef SO_BUSY_POLL
+	setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+#endif
+}
 
-    printf("add client... \n");
+//add client, assign fd to a free socket,which is a struct
+//return NULL when the connection is refused
+static struct socket *
+_add_client(struct mread_pool * self, int fd, int listener) {
 
     //get one socket instant
 	struct socket * s = _alloc_socket(self);
 	if (s == NULL) {
-        printf("no free socket ,return NULL \n");
-		close(fd);
-		return;
-	}
-#ifdef HAVE_EPOLL
-	struct epoll_event ev;
-	ev.events = EPOLLIN;
-	ev.data.ptr = s;
-	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		MREAD_ERROR("MREAD no free socket for fd %d\n", fd);
 		close(fd);
-		return;
+		return NULL;
 	}
-#elif HAVE_KQUEUE
-	struct kevent ke;
-	EV_SET(&ke, fd, EVFILT_READ, EV_ADD, 0, 0, s);
-	if (kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL) == -1) {        //register change for socket
+	if (_register_client(self, s, fd) == -1) {
+		_free_socket(self, s);
 		close(fd);
-		return;
+		return NULL;
 	}
-#endif
 
+	if (self->busy_socket > 0) {
+		_busy_socket(fd, self->busy_socket);
+	}
 	s->fd = fd;
+	s->listener = listener;
+	s->datagram = 0;
 	s->node = NULL;
+	s->tail = NULL;
 	s->status = SOCKET_SUSPEND;
+	s->drain = 0;
+	s->eof = 0;
+	s->paused = 0;
+	s->pending = 0;
+	s->batch = 0;
+	s->wait_out = 0;
+	memset(&self->socket_stat[s - self->sockets], 0, sizeof(struct mread_socket_stats));
+	s->frame_header = self->frame_header;
+	s->frame_big_endian = self->frame_big_endian;
+	s->frame_max = self->frame_max;
+	if (self->timer) {
+		struct deadline * d = &self->deadline[s - self->sockets];
+		d->idle_timeout = self->idle_timeout;
+		d->read_timeout = self->read_timeout;
+		_timer_start(self, s);
+	}
+	ringbuffer_priority(self->rb, s - self->sockets, 0);
+	++self->stat.connection;
+	MREAD_TRACE_EVENT(MREAD_TRACE_ACCEPT, (int)(s - self->sockets), fd);
+	return s;
 }
 
-static int
-_report_closed(struct mread_pool * self) {
+//accept the backlog until EAGAIN or the budget is used up , the listen socket is level triggered
+//so the rest will be reported by the next poll
+static void
+_accept_clients(struct mread_pool * self, int index) {
+	struct listener * l = &self->listener[index];
 	int i;
-	for (i=0;i<self->max_connection;i++) {
-		if (self->sockets[i].status == SOCKET_CLOSED) {     //find a closed socket
-			self->active = i;   //return its index
-			return i;
+	for (i=0;i<l->budget;i++) {
+		struct sockaddr_storage remote_addr;
+		socklen_t len = sizeof(remote_addr);
+#ifdef HAVE_ACCEPT4
+		int client_fd = accept4(l->fd , (struct sockaddr *)&remote_addr , &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		int client_fd = accept(l->fd , (struct sockaddr *)&remote_addr ,  &len);
+		if (client_fd >= 0) {
+			_set_nonblocking(client_fd);
+			fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+		}
+#endif
+		if (client_fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			return;
+		}
+		MREAD_INFO("MREAD connect (fd=%d , listener %d)\n", client_fd, index);
+		++self->stat.accept;
+		if (!_add_client(self, client_fd, index)) {
+			++self->stat.refuse;
 		}
 	}
-	assert(0);
-	return -1;
 }
 
+static inline int
+_uring_mode(struct mread_pool * self) {
+#ifdef HAVE_IO_URING
+	return self->uring != NULL;
+#else
+	return 0;
+#endif
+}
 
-//poll event ,get socket id
-int
-mread_poll(struct mread_pool * self , int timeout) {
+//queue a socket which may still have data in kernel, it will be returned by poll without a new event
+static void
+_drain_push(struct mread_pool * self, struct socket * s) {
+	s->drain = 1;
+	if (s->drain_next != DRAIN_NONE) {
+		return;
+	}
+	int index = s - self->sockets;
+	s->drain_next = -1;
+	if (self->drain_tail >= 0) {
+		self->sockets[self->drain_tail].drain_next = index;
+	} else {
+		self->drain_head = index;
+	}
+	self->drain_tail = index;
+	++self->drain_count;
+}
 
-//    printf("mread poll start... \n");
+//pop sockets queued before this round , skip the closed ones
+static struct socket *
+_drain_pop(struct mread_pool * self) {
+	while (self->drain_round > 0 && self->drain_head >= 0) {
+		struct socket * s = &self->sockets[self->drain_head];
+		self->drain_head = s->drain_next;
+		if (self->drain_head < 0) {
+			self->drain_tail = -1;
+		}
+		s->drain_next = DRAIN_NONE;
+		--self->drain_count;
+		--self->drain_round;
+		if (s->status >= SOCKET_ALIVE && s->drain && s->forward == NULL) {
+			return s;
+		}
+	}
+	self->drain_round = 0;
+	return NULL;
+}
 
-	self->skip = 0;                                     //todo ?
+#ifdef HAVE_EPOLL
+//read events unless paused , write events while the output waits for room
+static void
+_modify_client(struct mread_pool * self, struct socket * s) {
+	struct epoll_event ev;
+	ev.events = s->paused || (s->forward && s->forward->blocked) ? 0 : EPOLLIN;
+	if (s->wait_out) {
+		ev.events |= EPOLLOUT;
+	}
+	if (self->edge_trigger) {
+		ev.events |= EPOLLET;
+	}
+	ev.data.ptr = s;
+	epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+#endif
 
-//    printf(" active is %d : \n",self->active);
+//backpressure : disable the read event , the data stays in the kernel and tcp flow control slows the peer
+static void
+_pause(struct mread_pool * self, struct socket * s) {
+	s->paused = 1;
+	s->status = SOCKET_SUSPEND;
+	s->drain = 0;
+	++self->pause_count;
+	++self->stat.pause;
+	self->pause_space = ringbuffer_space(self->rb);
+	MREAD_DEBUG("MREAD pause %d\n", (int)(s - self->sockets));
+#ifdef HAVE_EPOLL
+	_modify_client(self, s);
+#elif HAVE_KQUEUE
+	struct kevent ke;
+	EV_SET(&ke, s->fd, EVFILT_READ, EV_DISABLE, 0, 0, s);
+	kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL);
+#endif
+	if (s->pause_next == PAUSE_NONE) {
+		s->pause_next = self->pause_head;
+		self->pause_head = s - self->sockets;
+	}
+}
 
-	if (self->active >= 0) {
+#ifdef HAVE_IO_URING
+static void _uring_unhold_all(struct mread_pool * self);
+#endif
 
-		struct socket * s = &self->sockets[self->active];
-		if (s->status == SOCKET_READ) {
-			return self->active;
-		}
+//enough free space again , enable the read event of the paused sockets , skip the closed ones
+static void
+_resume(struct mread_pool * self) {
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		_uring_unhold_all(self);
+		return;
 	}
-	if (self->closed > 0 ) {
-		return _report_closed(self);
+#endif
+	while (self->pause_head >= 0) {
+		struct socket * s = &self->sockets[self->pause_head];
+		self->pause_head = s->pause_next;
+		s->pause_next = PAUSE_NONE;
+		if (s->status < SOCKET_ALIVE || !s->paused) {
+			continue;
+		}
+		s->paused = 0;
+		--self->pause_count;
+		MREAD_DEBUG("MREAD resume %d\n", (int)(s - self->sockets));
+#ifdef HAVE_EPOLL
+		_modify_client(self, s);
+#elif HAVE_KQUEUE
+		struct kevent ke;
+		EV_SET(&ke, s->fd, EVFILT_READ, EV_ENABLE, 0, 0, s);
+		kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL);
+#endif
 	}
-	if (self->queue_head >= self->queue_len) {
-		if (_read_queue(self, timeout) == -1) {
-
-            printf("set self active \n");
+}
 
-			self->active = -1;
-			return -1;
+//resume the paused sockets when the free space is back to the high watermark
+static void
+_resume_free(struct mread_pool * self) {
+	if (self->pause_head >= 0) {
+		int space = ringbuffer_space(self->rb);
+		if (space >= self->high_free && space > self->pause_space) {
+			_resume(self);
 		}
 	}
+}
 
-	//start polling
-	for (;;) {
+//a span release woke the poll thread , the blocks it unpins may resume the paused sockets
+static void
+_woken(struct mread_pool * self) {
+	_span_reclaim(self);
+	_resume_free(self);
+}
 
-//        printf("in loop \n");
+static void
+_close_push(struct mread_pool * self, struct socket * s) {
+	++self->closed;
+	if (s->close_next != CLOSE_NONE) {     //freed and closed again before it reached the head
+		return;
+	}
+	int index = s - self->sockets;
+	s->close_next = -1;
+	if (self->close_tail >= 0) {
+		self->sockets[self->close_tail].close_next = index;
+	} else {
+		self->close_head = index;
+	}
+	self->close_tail = index;
+}
 
-		struct socket * s = _read_one(self);
-		if (s == NULL) {
-			self->active = -1;
-			return -1;
+//unlink the one after prev (the head if prev is -1) , return the next
+static int
+_close_unlink(struct mread_pool * self, int prev, struct socket * s) {
+	int next = s->close_next;
+	if (prev >= 0) {
+		self->sockets[prev].close_next = next;
+	} else {
+		self->close_head = next;
+	}
+	if (next < 0) {
+		self->close_tail = prev;
+	}
+	s->close_next = CLOSE_NONE;
+	return next;
+}
+
+//the oldest closed socket , it stays at the head until it's freed by mread_closed
+static int
+_report_closed(struct mread_pool * self) {
+	while (self->close_head >= 0) {
+		struct socket * s = &self->sockets[self->close_head];
+		if (s->status == SOCKET_CLOSED) {
+			self->active = self->close_head;
+			return self->close_head;
 		}
-		if (s == LISTENSOCKET) {    //new socket conn
+		_close_unlink(self, -1, s);
+	}
+	assert(0);
+	return -1;
+}
 
-            printf("LISTENSOCKET \n");
+//put a closed socket reported dry back to the free list
+static void
+_free_closed(struct mread_pool * self, struct socket * s) {
+	int index = s - self->sockets;
+	--self->closed;
+	s->status = SOCKET_INVALID;
+	s->fd = -1;
+	s->free_next = -1;
+	if (self->free_tail >= 0) {
+		self->sockets[self->free_tail].free_next = index;
+	} else {
+		self->free_head = index;
+	}
+	self->free_tail = index;
+	if (self->active == index) {
+		self->skip = 0;
+		self->active = -1;
+	}
+}
 
-			struct sockaddr_in remote_addr;
-			socklen_t len = sizeof(struct sockaddr_in);
 
-            //accept
-			int client_fd = accept(self->listen_fd , (struct sockaddr *)&remote_addr ,  &len);
+//arm the write event while the output waits for room in the kernel buffer
+static void
+_wait_out(struct mread_pool * self, struct socket * s, int on) {
+	if (s->wait_out == on) {
+		return;
+	}
+	s->wait_out = on;
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		if (on && _uring_pollout(self, s) == -1) {
+			s->wait_out = 0;
+			_flush_push(self, s);
+		}
+		return;
+	}
+#endif
+#ifdef HAVE_EPOLL
+	_modify_client(self, s);
+#elif HAVE_KQUEUE
+	struct kevent ke;
+	EV_SET(&ke, s->fd, EVFILT_WRITE, on ? EV_ADD : EV_DELETE, 0, 0, s);
+	kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL);
+#endif
+}
 
-            //print result
-			if (client_fd >= 0) {
-				printf("MREAD connect %s:%u (fd=%d)\n",inet_ntoa(remote_addr.sin_addr),ntohs(remote_addr.sin_port), client_fd);
-				_add_client(self, client_fd);
+//writev the queue , SENDVEC chunks a call. sendmsg is used for MSG_NOSIGNAL
+static void
+_send(struct mread_pool * self, struct socket * s) {
+	struct iovec iov[SENDVEC];
+	while (s->whead) {
+		int n = 0;
+		ssize_t size = 0;
+		struct wchunk * c;
+		for (c = s->whead; c && n < SENDVEC; c = c->next) {
+			iov[n].iov_base = (char *)(c + 1) + c->head;
+			iov[n].iov_len = c->tail - c->head;
+			size += iov[n].iov_len;
+			++n;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		ssize_t bytes = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+		++self->stat.send;
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				_wait_out(self, s, 1);
+				return;
+			}
+            //the connection is broken , the read side will report the close
+			MREAD_INFO("MREAD send %d error %d\n", (int)(s - self->sockets), errno);
+			_wqueue_clear(self, s);
+			break;
+		}
+		self->stat.send_bytes += bytes;
+		ssize_t left = bytes;
+		while (left > 0) {
+			c = s->whead;
+			int length = c->tail - c->head;
+			if (left < length) {
+				c->head += left;
+				break;
 			}
-		} else {    //new data
+			left -= length;
+			s->whead = c->next;
+			_wchunk_delete(self, c);
+		}
+		if (s->whead == NULL) {
+			s->wtail = NULL;
+		}
+		if (bytes < size) {
+			_wait_out(self, s, 1);
+			return;
+		}
+	}
+	_wait_out(self, s, 0);
+}
 
-            printf("not LISTENSOCKET \n");
+//send the output queued since the last wait
+static void
+_flush(struct mread_pool * self) {
+	while (self->flush_head >= 0) {
+		struct socket * s = &self->sockets[self->flush_head];
+		self->flush_head = s->flush_next;
+		s->flush_next = FLUSH_NONE;
+		if (s->status >= SOCKET_ALIVE && s->whead) {
+			_send(self, s);
+		}
+	}
+}
 
-			int index = s - self->sockets;             //get offset of 's' to address of sockets array
+#ifdef HAVE_SPLICE
 
-			assert(index >=0 && index < self->max_connection);
-			self->active = index;
+static void
+_forward_stop(struct mread_pool * self, struct socket * s) {
+	struct forward * f = s->forward;
+	if (f == NULL) {
+		return;
+	}
+	s->forward = NULL;
+	if (f->registered) {
+        //the fd of the user still refers to the file , so closing the dup doesn't remove it from epoll
+		epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, f->fd, NULL);
+	}
+	close(f->fd);
+	close(f->pipe[0]);
+	close(f->pipe[1]);
+	if (f->blocked && s->status >= SOCKET_ALIVE) {
+		_modify_client(self, s);
+	}
+	free(f);
+}
 
-            printf("self active is %d \n",self->active);
+//fd is full : stop reading the socket until the write event of fd , it's one shot
+static void
+_forward_block(struct mread_pool * self, struct socket * s, int blocked) {
+	struct forward * f = s->forward;
+	if (blocked) {
+		struct epoll_event ev;
+		ev.events = EPOLLOUT | EPOLLONESHOT;
+		ev.data.ptr = s;
+		if (epoll_ctl(self->epoll_fd, f->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, f->fd, &ev) == -1) {
+			MREAD_ERROR("MREAD forward %d can't poll fd %d\n", (int)(s - self->sockets), f->fd);
+			return;
+		}
+		f->registered = 1;
+	}
+	if (f->blocked != blocked) {
+		f->blocked = blocked;
+		_modify_client(self, s);
+	}
+}
 
-			s->status = SOCKET_POLLIN;
-			return index;
+//the data buffered in the ring buffer goes first , then socket -> pipe -> fd until the socket or fd would block.
+//the socket is closed (and reported) at eof , or when fd is broken
+static void
+_forward(struct mread_pool * self, struct socket * s) {
+	struct forward * f = s->forward;
+	int id = s - self->sockets;
+	for (;;) {
+		ssize_t n;
+		if (s->node) {
+			struct ringbuffer_block * blk = s->node;
+			n = write(f->fd, (char *)(blk + 1) + blk->offset, blk->length - sizeof(struct ringbuffer_block) - blk->offset);
+		} else if (f->pipe_bytes > 0) {
+			n = splice(f->pipe[0], NULL, f->fd, NULL, f->pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		} else if (f->eof) {
+			if (f->flags & MREAD_FORWARD_SHUTDOWN) {
+				shutdown(f->fd, SHUT_WR);
+			}
+			mread_close_client(self, id);
+			return;
+		} else {
+			n = splice(s->fd, NULL, f->pipe[1], NULL, FORWARDSIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			++self->stat.recv;
+			if (n > 0) {
+				f->pipe_bytes += n;
+				self->stat.bytes += n;
+				self->socket_stat[id].bytes += n;
+				if (self->deadline) {
+					self->deadline[id].recv = self->now;
+				}
+			} else if (n == 0) {
+				f->eof = 1;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				_forward_block(self, s, 0);
+				return;
+			} else if (errno != EINTR) {
+				f->eof = 1;
+			}
+			continue;
+		}
+		if (n > 0) {
+			self->stat.forward += n;
+			if (s->node) {
+				s->node = ringbuffer_yield(self->rb, s->node, n);
+				if (s->node == NULL) {
+					s->tail = NULL;
+				}
+			} else {
+				f->pipe_bytes -= n;
+			}
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			_forward_block(self, s, 1);
+			return;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			MREAD_INFO("MREAD forward %d to fd %d error %d\n", id, f->fd, errno);
+			mread_close_client(self, id);
+			return;
 		}
 	}
 }
 
-int
-mread_socket(struct mread_pool * self, int index) {
-	return self->sockets[index].fd;
+#else
+
+static void
+_forward_stop(struct mread_pool * self, struct socket * s) {
 }
 
 static void
-_link_node(struct ringbuffer * rb, int id, struct socket * s , struct ringbuffer_block * blk) {
-	if (s->node) {
-		ringbuffer_link(rb, s->node , blk);
-	} else {
-		blk->id = id;
-		s->node = blk;
-	}
+_forward(struct mread_pool * self, struct socket * s) {
 }
 
-void
-mread_close_client(struct mread_pool * self, int id) {
-	struct socket * s = &self->sockets[id];
-	s->status = SOCKET_CLOSED;
-	s->node = NULL;
-	s->temp = NULL;
-	close(s->fd);
-	printf("MREAD close %d (fd=%d)\n",id,s->fd);
+#endif
 
-#ifdef HAVE_EPOLL
-	epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, s->fd , NULL);
-#elif HAVE_KQUEUE
-	struct kevent ke;
+//the deadline of a connection , 0 if it has no timeout
+static uint64_t
+_deadline(struct deadline * d) {
+	uint64_t t = 0;
+	if (d->idle_timeout > 0) {
+		t = d->recv + d->idle_timeout;
+	}
+	if (d->read_timeout > 0 && d->read > 0 && (t == 0 || d->read + d->read_timeout < t)) {
+		t = d->read + d->read_timeout;
+	}
+	return t;
+}
+
+//close the connections past their deadline , they are reported by the closed queue. the others set the timer again
+static void
+_timeout(struct mread_pool * self) {
+	self->now = _now_ms();
+	int id;
+	while ((id = timerwheel_expire(self->timer, self->now)) >= 0) {
+		if (self->sockets[id].status < SOCKET_ALIVE) {
+			continue;
+		}
+		uint64_t t = _deadline(&self->deadline[id]);
+		if (t > self->now) {
+			_timer_set(self, id);
+			if (t < timerwheel_get(self->timer, id)) {
+				timerwheel_add(self->timer, id, t);
+			}
+		} else if (t > 0) {
+			MREAD_INFO("MREAD timeout %d\n", id);
+			++self->stat.timeout;
+			mread_close_client(self, id);
+		}
+	}
+}
+
+//the grown ring buffer shrinks back when its end stays free for buffer_idle ms
+static void
+_release_buffer(struct mread_pool * self) {
+	uint64_t now = _now_ms();
+	if (now - self->release_time < self->buffer_idle) {
+		return;
+	}
+	self->release_time = now;
+	ringbuffer_release(self->rb);
+}
+
+//busy poll : non-blocking waits for up to busy_poll us (or the timeout) , then the blocking one for the rest of the
+//timeout. the time from the start to the events (capped at twice busy_poll) is averaged into spin_gap , a pool
+//whose events come further apart than busy_poll blocks at once , so it doesn't burn a core when it's idle
+static int
+_busy_wait(struct mread_pool * self, int timeout) {
+	uint64_t start = _now_us();
+	uint64_t now = start;
+	int n = 0;
+	if (self->spin_gap < self->busy_poll) {
+		uint64_t spin = self->busy_poll;
+		if (timeout > 0 && spin > (uint64_t)timeout * 1000) {
+			spin = (uint64_t)timeout * 1000;
+		}
+		do {
+			n = _read_queue(self, 0);
+			++self->stat.wait;
+			now = _now_us();
+		} while (n == 0 && now - start < spin);
+		self->stat.spin_us += now - start;
+		if (n > 0) {
+			++self->stat.spin_hit;
+		}
+	}
+	if (n == 0) {
+		if (timeout > 0) {
+			timeout -= (int)((now - start) / 1000);
+			if (timeout < 0) {
+				timeout = 0;
+			}
+		}
+		uint64_t t = now;
+		n = _read_queue(self, timeout);
+		++self->stat.wait;
+		now = _now_us();
+		self->stat.sleep_us += now - t;
+	}
+	uint64_t gap = now - start;
+	if (gap > (uint64_t)self->busy_poll * 2) {
+		gap = (uint64_t)self->busy_poll * 2;
+	}
+	self->spin_gap = (self->spin_gap * 7 + (int)gap) / 8;
+	return n;
+}
+
+//wait for events when the queue is used up , return -1 on error
+static int
+_wait(struct mread_pool * self, int timeout) {
+	if (self->place_pending) {
+		self->place_pending = 0;
+		_place_rb(self, MREAD_NUMA_POLL, -1);
+	}
+	_span_reclaim(self);
+	_resume_free(self);
+	if (self->buffer_idle > 0) {
+		_release_buffer(self);
+	}
+	if (self->queue_head >= self->queue_len && self->drain_round == 0) {
+		_flush(self);
+        //don't block when some sockets are waiting to be drained
+		if (self->drain_count > 0) {
+			timeout = 0;
+		}
+		if (self->timer) {
+			self->now = _now_ms();
+			int next = timerwheel_next(self->timer, self->now);
+			if (next >= 0 && (timeout < 0 || next < timeout)) {
+				timeout = next;
+			}
+		}
+		int n;
+		if (self->busy_poll > 0 && timeout != 0) {
+			n = _busy_wait(self, timeout);
+		} else {
+			n = _read_queue(self, timeout);
+			++self->stat.wait;
+		}
+		MREAD_TRACE_EVENT(MREAD_TRACE_POLL, -1, n);
+		if (n == -1) {
+			return -1;
+		}
+		if (n == 0 && timeout != 0 && self->pause_head >= 0) {
+            //nothing happened , waiting won't free the ring buffer , let the paused sockets read (or collect)
+			_resume(self);
+		}
+		self->drain_round = self->drain_count;
+		if (self->timer) {
+			_timeout(self);
+		}
+	}
+	return 0;
+}
+
+//poll event ,get socket id
+int
+mread_poll(struct mread_pool * self , int timeout) {
+
+	self->skip = 0;                                     //todo ?
+
+	if (self->active >= 0) {
+
+		struct socket * s = &self->sockets[self->active];
+		if (s->status == SOCKET_READ) {
+			return self->active;
+		}
+		if (s->status == SOCKET_POLLIN && (self->edge_trigger || _uring_mode(self))) {
+            //not pulled , the edge is gone
+			_drain_push(self, s);
+		}
+	}
+	if (self->closed > 0 ) {
+		return _report_closed(self);
+	}
+	if (_wait(self, timeout) == -1) {
+		self->active = -1;
+		return -1;
+	}
+	if (self->closed > 0) {
+		return _report_closed(self);
+	}
+
+	//start polling
+	for (;;) {
+
+		struct socket * s = _read_one(self);
+		if (s == NULL) {
+			s = _drain_pop(self);
+			if (s == NULL) {
+				self->active = -1;
+				return -1;
+			}
+			int index = s - self->sockets;
+			self->active = index;
+			s->status = SOCKET_POLLIN;
+			return index;
+		}
+		if (ISLISTENSOCKET(s)) {    //new socket conn
+			MREAD_DEBUG("MREAD poll listen\n");
+			_accept_clients(self, LISTENINDEX(s));
+		} else if (s->forward) {
+			_forward(self, s);
+		} else if (s->status >= SOCKET_ALIVE) {    //new data , the event of a socket closed (collected) since the wait is stale
+
+			int index = s - self->sockets;             //get offset of 's' to address of sockets array
+
+			assert(index >=0 && index < self->max_connection);
+			self->active = index;
+			MREAD_DEBUG("MREAD poll %d\n", index);
+			s->status = SOCKET_POLLIN;
+			return index;
+		}
+	}
+}
+
+//the sockets of the last batch not pulled dry are drained again , like the active one in mread_poll
+static void
+_batch_reset(struct mread_pool * self) {
+	int i;
+	for (i=0;i<self->batch_len;i++) {
+		struct socket * s = &self->sockets[self->batch[i]];
+		s->batch = 0;
+		if (s->status == SOCKET_READ) {
+			s->status = SOCKET_SUSPEND;
+			_drain_push(self, s);
+		} else if (s->status == SOCKET_POLLIN && (self->edge_trigger || _uring_mode(self))) {
+			_drain_push(self, s);
+		}
+	}
+	self->batch_len = 0;
+	self->active = -1;
+	self->skip = 0;
+}
+
+static void
+_batch_add(struct mread_pool * self, struct socket * s, int * ids) {
+	int index = s - self->sockets;
+	s->batch = 1;
+	ids[self->batch_len] = index;
+	self->batch[self->batch_len++] = index;
+}
+
+//set the timeouts (ms , 0 for none) of id , -1 for the default of new connections
+void
+mread_timeout(struct mread_pool * self, int id, int idle, int read) {
+	if (idle < 0) {
+		idle = 0;
+	}
+	if (read < 0) {
+		read = 0;
+	}
+	if (id < 0) {
+		if ((idle > 0 || read > 0) && _timer_init(self) < 0) {
+			return;
+		}
+		self->idle_timeout = idle;
+		self->read_timeout = read;
+		return;
+	}
+	if (id >= self->max_connection || self->sockets[id].status < SOCKET_ALIVE) {
+		return;
+	}
+	if (self->sockets[id].datagram) {
+        //a udp socket is never closed by a timeout , only the default timers of _add_client are cleared
+		idle = 0;
+		read = 0;
+	}
+	if (self->timer == NULL) {
+		if ((idle == 0 && read == 0) || _timer_init(self) < 0) {
+			return;
+		}
+	}
+	struct deadline * d = &self->deadline[id];
+	d->idle_timeout = idle;
+	d->read_timeout = read;
+	_timer_start(self, &self->sockets[id]);
+}
+
+//add a bound udp socket as a connection , it's never closed by collect or timeouts. return its id or -1 , the fd is
+//closed on failure
+int
+mread_udp_fd(struct mread_pool * self, int fd, int flags) {
+	if (_uring_mode(self) || _set_nonblocking(fd) == -1) {
+		close(fd);
+		return -1;
+	}
+	if (flags & MREAD_UDP_GRO) {
+        //a gro slot takes a quarter of the ring buffer at most , or it's off
+		struct ringbuffer_stats rs;
+		ringbuffer_stats(self->rb, &rs);
+		if ((4 + (int)sizeof(struct mread_udp_source)) * DGRAMGROSEGS + DGRAMGROSIZE > rs.size / 4) {
+			flags &= ~MREAD_UDP_GRO;
+		}
+	}
+	if (flags & MREAD_UDP_GRO) {
+#ifdef UDP_GRO
+		int one = 1;
+		if (setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == -1) {
+			flags &= ~MREAD_UDP_GRO;
+		}
+#else
+		flags &= ~MREAD_UDP_GRO;
+#endif
+	}
+	struct socket * s = _add_client(self, fd, 0);
+	if (s == NULL) {
+		return -1;
+	}
+	int id = s - self->sockets;
+	s->datagram = DGRAM_ON | (flags & MREAD_UDP_SOURCE ? DGRAM_SOURCE : 0) | (flags & MREAD_UDP_GRO ? DGRAM_GRO : 0);
+	s->frame_header = 4;
+	s->frame_big_endian = 1;
+	s->frame_max = self->datagram_max + sizeof(struct mread_udp_source);
+    //the timers armed for a new connection are cleared , later timeouts of id are ignored
+	mread_timeout(self, id, 0, 0);
+	return id;
+}
+
+//bind a udp socket to addr (NULL or "*" for any v4 address , or a v4 / v6 address) and port
+int
+mread_udp(struct mread_pool * self, const char * addr, int port, int flags) {
+	struct sockaddr_storage ss;
+	memset(&ss, 0, sizeof(ss));
+	socklen_t len;
+	if (addr && strchr(addr, ':')) {
+		struct sockaddr_in6 * in6 = (struct sockaddr_in6 *)&ss;
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons(port);
+		if (inet_pton(AF_INET6, addr, &in6->sin6_addr) != 1) {
+			return -1;
+		}
+		len = sizeof(*in6);
+	} else {
+		struct sockaddr_in * in = (struct sockaddr_in *)&ss;
+		in->sin_family = AF_INET;
+		in->sin_port = htons(port);
+		in->sin_addr.s_addr = htonl(INADDR_ANY);
+		if (addr && strcmp(addr, "*") != 0 && inet_pton(AF_INET, addr, &in->sin_addr) != 1) {
+			return -1;
+		}
+		len = sizeof(*in);
+	}
+	int fd = socket(ss.ss_family, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	int reuse = 1;
+	if (self->reuseport) {
+#ifdef SO_REUSEPORT
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(int));
+#endif
+	}
+	if (ss.ss_family == AF_INET6) {
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &reuse, sizeof(int));
+	}
+	if (bind(fd, (struct sockaddr *)&ss, len) == -1) {
+		close(fd);
+		return -1;
+	}
+	MREAD_INFO("MREAD bind udp %s:%d\n", addr ? addr : "*", port);
+	return mread_udp_fd(self, fd, flags);
+}
+
+static void
+_batch_closed(struct mread_pool * self, int * ids, int max) {
+	if (self->closed == 0) {
+		return;
+	}
+	int prev = -1;
+	int i = self->close_head;
+	while (i >= 0 && self->batch_len < max) {
+		struct socket * s = &self->sockets[i];
+		if (s->status != SOCKET_CLOSED) {
+			i = _close_unlink(self, prev, s);
+			continue;
+		}
+		if (!s->batch) {
+			_batch_add(self, s, ids);
+		}
+		prev = i;
+		i = s->close_next;
+	}
+}
+
+//every ready id of one wait , the closed ones first. select one of them before pull
+int
+mread_poll_batch(struct mread_pool * self , int * ids , int max , int timeout) {
+	_batch_reset(self);
+	if (max > self->batch_cap) {
+		self->batch = realloc(self->batch, max * sizeof(int));
+		self->batch_cap = max;
+	}
+	_batch_closed(self, ids, max);
+	if (_wait(self, self->batch_len > 0 ? 0 : timeout) == -1) {
+		return self->batch_len > 0 ? self->batch_len : -1;
+	}
+    //closed by the wait (timeout , send error)
+	_batch_closed(self, ids, max);
+	while (self->batch_len < max) {
+		struct socket * s = _read_one(self);
+		if (s == NULL) {
+			s = _drain_pop(self);
+			if (s == NULL) {
+				break;
+			}
+		} else if (ISLISTENSOCKET(s)) {
+			_accept_clients(self, LISTENINDEX(s));
+			continue;
+		} else if (s->forward) {
+			_forward(self, s);
+			continue;
+		} else if (s->status < SOCKET_ALIVE) {
+			continue;
+		}
+		if (!s->batch) {
+			s->status = SOCKET_POLLIN;
+			_batch_add(self, s, ids);
+		}
+	}
+	return self->batch_len;
+}
+
+//make id the one pull , yield and closed work on
+int
+mread_select(struct mread_pool * self , int id) {
+	if (id < 0 || id >= self->max_connection || self->sockets[id].status == SOCKET_INVALID) {
+		self->active = -1;
+		return -1;
+	}
+	self->active = id;
+	self->skip = 0;
+	return 0;
+}
+
+int
+mread_socket(struct mread_pool * self, int index) {
+	return self->sockets[index].fd;
+}
+
+//generation << 32 | id , the generation (version) changes for each client , 0 if id is not in use
+uint64_t
+mread_handle(struct mread_pool * self, int id) {
+	if (id < 0 || id >= self->max_connection || self->sockets[id].status == SOCKET_INVALID) {
+		return 0;
+	}
+	return (uint64_t)self->sockets[id].version << 32 | (uint64_t)id;
+}
+
+//the id of a handle , -1 if the client of the handle is gone (closed , or the id is reused)
+int
+mread_handle_id(struct mread_pool * self, uint64_t handle) {
+	uint32_t id = (uint32_t)handle;
+	if (id >= (uint32_t)self->max_connection) {
+		return -1;
+	}
+	struct socket * s = &self->sockets[id];
+	if (s->version != (unsigned)(handle >> 32) || s->status < SOCKET_ALIVE) {
+		return -1;
+	}
+	return id;
+}
+
+//queue the output of id , it's sent (writev) before the next wait for events
+int
+mread_send(struct mread_pool * self, int id, const void * buffer, int size) {
+	struct iovec iov;
+	iov.iov_base = (void *)buffer;
+	iov.iov_len = size;
+	return mread_sendv(self, id, &iov, 1);
+}
+
+int
+mread_sendv(struct mread_pool * self, int id, const struct iovec * iov, int n) {
+	if (id < 0 || id >= self->max_connection || self->sockets[id].status < SOCKET_ALIVE) {
+		return -1;
+	}
+	struct socket * s = &self->sockets[id];
+	int i;
+	for (i=0;i<n;i++) {
+		_wqueue(self, s, iov[i].iov_base, iov[i].iov_len);
+	}
+	if (s->whead && !s->wait_out) {
+		_flush_push(self, s);
+	}
+	return 0;
+}
+
+void
+mread_flush(struct mread_pool * self) {
+	_flush(self);
+}
+
+//the data of id (not pulled yet) goes to fd by splice from now on , id is yielded if it's the active one.
+//fd -1 stops it. return -1 if id is not alive , or splice is not supported (io_uring , kqueue)
+int
+mread_forward(struct mread_pool * self, int id, int fd, int flags) {
+#ifdef HAVE_SPLICE
+	if (_uring_mode(self) || id < 0 || id >= self->max_connection || self->sockets[id].status < SOCKET_ALIVE) {
+		return -1;
+	}
+	struct socket * s = &self->sockets[id];
+	_forward_stop(self, s);
+	if (fd < 0) {
+		return 0;
+	}
+	struct forward * f = malloc(sizeof(*f));
+	if (pipe2(f->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+		free(f);
+		return -1;
+	}
+	f->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (f->fd == -1) {
+		close(f->pipe[0]);
+		close(f->pipe[1]);
+		free(f);
+		return -1;
+	}
+	f->pipe_bytes = 0;
+	f->flags = flags;
+	f->eof = 0;
+	f->blocked = 0;
+	f->registered = 0;
+	if (self->active == id) {
+		mread_yield(self);
+		self->active = -1;
+	}
+	s->forward = f;
+	if (s->status == SOCKET_READ || s->status == SOCKET_POLLIN) {
+		s->status = SOCKET_SUSPEND;
+	}
+	_forward(self, s);
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+//the connection with the lowest priority is collected first under MREAD_COLLECT_PRIORITY
+void
+mread_priority(struct mread_pool * self, int id, int priority) {
+	if (id < 0 || id >= self->max_connection || self->sockets[id].status < SOCKET_ALIVE) {
+		return;
+	}
+	ringbuffer_priority(self->rb, id, priority);
+}
+
+//id -1 sets the default of the pool
+void
+mread_frame(struct mread_pool * self, int id, int header, int big_endian, int max) {
+	if (header != 1 && header != 2 && header != 4 && header != 8) {
+		header = 0;
+	}
+	if (max <= 0 || max > INT_MAX - header) {
+		max = INT_MAX - header;
+	}
+	big_endian = big_endian != 0;
+	if (id < 0) {
+		self->frame_header = header;
+		self->frame_big_endian = big_endian;
+		self->frame_max = max;
+		return;
+	}
+	if (id >= self->max_connection) {
+		return;
+	}
+	struct socket * s = &self->sockets[id];
+	s->frame_header = header;
+	s->frame_big_endian = big_endian;
+	s->frame_max = max;
+}
+
+static void
+_link_node(struct ringbuffer * rb, int id, struct socket * s , struct ringbuffer_block * blk) {
+	if (blk == s->tail) {
+		return;
+	}
+	if (s->node) {
+		ringbuffer_link(rb, s->tail , blk);
+	} else {
+		ringbuffer_own(rb, blk, id);
+		s->node = blk;
+	}
+	s->tail = blk;
+}
+
+//grow the tail of s by size bytes when nothing is allocated after it , so a pull across recvs needs no temp copy.
+//the part pulled already is freed only with the whole block , so a tail which has more than a read block pulled
+//is left to be freed , or one busy connection would end up holding the whole ring buffer in a block.
+//*length is the data length of the tail before
+static struct ringbuffer_block *
+_expand_tail(struct ringbuffer * rb, struct socket * s, int size, int * length) {
+	struct ringbuffer_block * blk = s->tail;
+	if (blk == NULL || blk->offset >= READBLOCKSIZE) {
+		return NULL;
+	}
+	int sz = blk->length - sizeof(struct ringbuffer_block);
+	if (ringbuffer_expand(rb, blk, size) == NULL) {
+		return NULL;
+	}
+	*length = sz;
+	return blk;
+}
+
+static void
+_unregister_client(struct mread_pool * self, struct socket * s) {
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		_uring_cancel(self, s);
+		return;
+	}
+#endif
+#ifdef HAVE_EPOLL
+	epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, s->fd , NULL);
+#elif HAVE_KQUEUE
+	struct kevent ke;
 	EV_SET(&ke, s->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
 	kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL);
 #endif
+}
+
+void
+mread_close_client(struct mread_pool * self, int id) {
+	struct socket * s = &self->sockets[id];
+	if (s->status >= SOCKET_ALIVE) {
+		--self->stat.connection;
+		++self->stat.close;
+		if (s->paused && !_uring_mode(self)) {
+			s->paused = 0;
+			--self->pause_count;
+		}
+	}
+	s->status = SOCKET_CLOSED;
+	_forward_stop(self, s);
+	_wqueue_clear(self, s);
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		_uring_unhold_drop(self, s);
+	}
+#endif
+	s->wait_out = 0;
+	ringbuffer_free(self->rb, s->temp);
+	ringbuffer_free(self->rb, s->node);
+	s->node = NULL;
+	s->temp = NULL;
+	s->tail = NULL;
+	close(s->fd);
+	MREAD_INFO("MREAD close %d (fd=%d)\n",id,s->fd);
+	MREAD_TRACE_EVENT(MREAD_TRACE_CLOSE, id, s->fd);
+
+	_unregister_client(self, s);
+	if (self->timer) {
+		timerwheel_del(self->timer, id);
+	}
+
+	_close_push(self, s);
+}
+
+static void
+_close_active(struct mread_pool * self) {
+	mread_close_client(self, self->active);
+}
+
+//alloc from ring buffer , collect (close) a connection chosen by the collect policy when it's full
+//return NULL if id itself is collected
+static struct ringbuffer_block *
+_alloc_block(struct mread_pool * self, int id, int size) {
+	struct ringbuffer * rb = self->rb;
+	struct ringbuffer_block * blk = ringbuffer_alloc(rb, size);
+	while (blk == NULL) {
+		if (_span_reclaim(self) > 0) {
+			blk = ringbuffer_alloc(rb, size);
+			continue;
+		}
+		++self->stat.alloc_fail;
+		int collect_id = ringbuffer_collect(rb);
+		if (collect_id < 0) {
+			//nothing left to collect , the size never fits
+			collect_id = id;
+		}
+		++self->stat.collect;
+		//the blocks are released by collect already
+		struct socket * s = &self->sockets[collect_id];
+		s->node = NULL;
+		s->temp = NULL;
+		s->tail = NULL;
+		if (s->datagram) {
+            //a udp socket loses the datagrams buffered , not the socket
+			if (collect_id == self->active) {
+				self->skip = 0;
+			}
+		} else {
+			mread_close_client(self , collect_id);
+		}
+		if (id == collect_id) {
+			return NULL;
+		}
+		blk = ringbuffer_alloc(rb , size);
+	}
+	return blk;
+}
+
+#ifdef HAVE_IO_URING
+
+//copy one completion into the ring buffer, return 0 if the socket is collected.
+//without collect , return -1 if there's no room for it
+static int
+_uring_append(struct mread_pool * self, struct socket * s, const char * data, int size, int collect) {
+	int id = s - self->sockets;
+	int length = 0;
+	struct ringbuffer_block * blk = _expand_tail(self->rb, s, size, &length);
+	if (blk == NULL) {
+		if (!collect) {
+			blk = ringbuffer_alloc(self->rb, size);
+			if (blk == NULL) {
+				return -1;
+			}
+		} else {
+			blk = _alloc_block(self, id, size);
+			if (blk == NULL) {
+				return 0;
+			}
+		}
+	}
+	memcpy((char *)(blk + 1) + length, data, size);
+	_link_node(self->rb, id, s, blk);
+	++self->stat.recv;
+	_received(self, s, size);
+	MREAD_TRACE_EVENT(MREAD_TRACE_RECV, id, size);
+	return 1;
+}
+
+//backpressure : no room for a completion , it stays in its provided buffer after the ones held already and the
+//recv stops. the kernel runs short of provided buffers and tcp flow control slows the peer
+static void
+_uring_hold(struct mread_pool * self, struct socket * s, int bid, int size) {
+	self->held[bid].next = -1;
+	self->held[bid].size = size;
+	if (s->held_head < 0) {
+		s->held_head = bid;
+		++self->stat.pause;
+		self->pause_space = ringbuffer_space(self->rb);
+		if (s->pause_next == PAUSE_NONE) {
+			s->pause_next = self->pause_head;
+			self->pause_head = s - self->sockets;
+		}
+	} else {
+		self->held[s->held_tail].next = bid;
+	}
+	s->held_tail = bid;
+	if (!s->paused) {
+		s->paused = 1;
+		_uring_cancel(self, s);
+	}
+}
+
+//copy the held buffers of s into the ring buffer in order and recycle them , return how many are copied.
+//only a pull which needs more data collects , the others leave the room below the low watermark to it
+static int
+_uring_unhold(struct mread_pool * self, struct socket * s, int collect) {
+	int n = 0;
+	while (s->held_head >= 0) {
+		int bid = s->held_head;
+		if (!collect && ringbuffer_space(self->rb) < self->low_free) {
+			break;
+		}
+		int r = _uring_append(self, s, uring_buffer(self->uring, bid), self->held[bid].size, collect);
+		if (r < 0) {
+			break;
+		}
+		if (r == 0) {
+            //collected , the held buffers are recycled by mread_close_client
+			return 0;
+		}
+		s->held_head = self->held[bid].next;
+		uring_buffer_recycle(self->uring, bid);
+		++n;
+	}
+	if (s->held_head < 0) {
+		s->held_tail = -1;
+	}
+	return n;
+}
+
+//the ring buffer has room again , the sockets holding buffers back copy them in and are polled for them.
+//their recv starts again when it's pulled dry
+static void
+_uring_unhold_all(struct mread_pool * self) {
+	int head = self->pause_head;
+	self->pause_head = -1;
+	while (head >= 0) {
+		struct socket * s = &self->sockets[head];
+		head = s->pause_next;
+		s->pause_next = PAUSE_NONE;
+		if (s->status < SOCKET_ALIVE || s->held_head < 0) {
+			continue;
+		}
+		if (_uring_unhold(self, s, 0) > 0) {
+			_drain_push(self, s);
+		}
+		if (s->held_head >= 0) {
+			s->pause_next = self->pause_head;
+			self->pause_head = s - self->sockets;
+		}
+	}
+}
+
+static void
+_uring_complete(struct mread_pool * self, uint64_t ud, int res, unsigned flags) {
+	struct uring * ur = self->uring;
+	if (ISURINGLISTEN(ud)) {
+		int index = (int)(URING_LISTEN - ud);
+		if (res >= 0) {
+			MREAD_INFO("MREAD connect (fd=%d , listener %d)\n", res, index);
+			++self->stat.accept;
+			if (!_add_client(self, res, index)) {
+				++self->stat.refuse;
+			}
+		}
+		if (!(flags & IORING_CQE_F_MORE)) {
+			_uring_accept(ur, self->listener[index].fd, index);
+		}
+		return;
+	}
+	if (ud == URING_CANCEL) {
+		return;
+	}
+	if (ud == URING_WAKE) {
+		self->wake_armed = 0;
+		_woken(self);
+		return;
+	}
+	if ((uint32_t)ud & URING_POLLOUT) {
+		struct socket * s = &self->sockets[(uint32_t)ud & ~URING_POLLOUT];
+		if (s->version == (unsigned)(ud >> 32) && s->status >= SOCKET_ALIVE) {
+			s->wait_out = 0;
+			_flush_push(self, s);
+		}
+		return;
+	}
+	struct socket * s = &self->sockets[(uint32_t)ud];
+	int alive = s->version == (unsigned)(ud >> 32) && s->status >= SOCKET_ALIVE;
+	if (flags & IORING_CQE_F_BUFFER) {
+		int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		int r = 1;
+		if (alive && res > 0) {
+            //backpressure : never collect for the data pushed , hold it when the ring buffer is low (or held already)
+			r = -1;
+			if (!self->backpressure) {
+				r = _uring_append(self, s, uring_buffer(ur, bid), res, 1);
+			} else if (s->held_head < 0 && ringbuffer_space(self->rb) >= self->low_free) {
+				r = _uring_append(self, s, uring_buffer(ur, bid), res, 0);
+			}
+		}
+		if (r < 0) {
+			_uring_hold(self, s, bid, res);
+		} else {
+			alive = r;
+			uring_buffer_recycle(ur, bid);
+		}
+	}
+	if (!alive) {
+		return;
+	}
+	if (res > 0) {
+        //data is pushed by the kernel, so stop a connection which is not pulled fast enough
+        //(epoll reads on demand and leaves the rest in the kernel)
+        //and stop all of them when backpressure is on and the ring buffer is low
+		int low = self->backpressure && ringbuffer_space(self->rb) < self->low_free;
+		if ((++s->pending >= URING_PENDING || low) && !s->paused) {
+			s->paused = 1;
+			if (low) {
+				++self->stat.pause;
+			}
+			_uring_cancel(self, s);
+		}
+	}
+	if (!(flags & IORING_CQE_F_MORE)) {
+		s->armed = 0;
+		if (res > 0 || res == -ENOBUFS || res == -ECANCELED) {
+            //the multishot recv also stops when the buffer ring runs dry, buffers are recycled at once.
+            //when the submission queue is full , it's paused and polled , its pull end starts it again
+			if (!s->paused && _uring_recv(self, s, s->fd) == -1) {
+				s->paused = 1;
+				_drain_push(self, s);
+			}
+		} else {
+			s->eof = 1;
+		}
+	}
+	if (res > 0 || s->eof) {
+		_drain_push(self, s);
+	}
+}
 
-	++self->closed;
+//submit and wait for completions , then dispatch them. sockets with new data go to the drain list
+static int
+_uring_read_queue(struct mread_pool * self, int timeout) {
+	struct uring * ur = self->uring;
+	self->queue_len = 0;
+	if (self->wake && !self->wake_armed) {
+		_uring_wake(self);
+	}
+	int n = uring_wait(ur, timeout);
+	if (n < 0) {
+		return -1;
+	}
+	struct io_uring_cqe * cqe;
+	while ((cqe = uring_cqe(ur))) {
+		uint64_t ud = cqe->user_data;
+		int res = cqe->res;
+		unsigned flags = cqe->flags;
+		uring_cqe_seen(ur);
+		_uring_complete(self, ud, res, flags);
+	}
+	return n;
 }
 
+//the buffered data is pulled , restart the recv stopped by _uring_complete.
+//the buffers held back come first , the recv waits until they are all copied in
 static void
-_close_active(struct mread_pool * self) {
-	int id = self->active;
-	struct socket * s = &self->sockets[id];
-	ringbuffer_free(self->rb, s->temp);
-	ringbuffer_free(self->rb, s->node);
-	mread_close_client(self, id);
+_uring_resume(struct mread_pool * self, struct socket * s) {
+	s->pending = 0;
+	if (s->held_head >= 0) {
+		if (_uring_unhold(self, s, 0) > 0) {
+			_drain_push(self, s);
+		}
+		return;
+	}
+	if (s->paused) {
+		s->paused = 0;
+		if (!s->armed && _uring_recv(self, s, s->fd) == -1) {
+			s->paused = 1;
+			_drain_push(self, s);
+		}
+	}
+}
+
+//io_uring : no more buffered data , never recv here
+static void *
+_uring_pull_end(struct mread_pool * self, struct socket * s) {
+	if (s->status < SOCKET_ALIVE) {
+		return NULL;
+	}
+	if (s->eof) {
+		_close_active(self);
+		return NULL;
+	}
+	s->status = SOCKET_SUSPEND;
+	s->drain = 0;
+	_uring_resume(self, s);
+	return NULL;
 }
 
+#endif
+
 static char *
 _ringbuffer_read(struct mread_pool * self, int *size) {
 	struct socket * s = &self->sockets[self->active];
@@ -517,12 +2662,256 @@ _ringbuffer_read(struct mread_pool * self, int *size) {
 }
 
 
-//get data
-void *
-mread_pull(struct mread_pool * self , int size) {
+//the data is buffered but not continuous, copy it into a temp block. a pull without more (a later frame of
+//mread_pull_frames) never collects , it could free the active socket and the pulls given before it
+static void *
+_read_temp(struct mread_pool * self, int size, int more) {
+	int id = self->active;
+	struct socket * s = &self->sockets[id];
+	struct ringbuffer * rb = self->rb;
+	struct ringbuffer_block * temp = more ? _alloc_block(self, id, size) : ringbuffer_alloc(rb, size);
+	if (temp == NULL) {
+		return NULL;
+	}
+	++self->stat.copy;
+	ringbuffer_own(rb, temp, id);
+	if (s->temp) {
+		ringbuffer_link(rb, temp, s->temp);
+	}
+	s->temp = temp;
+	void * ret = ringbuffer_copy(rb, s->node, self->skip, temp);
+	assert(ret);
+	self->skip += size;
+	++self->socket_stat[self->active].pull;
+
+	return ret;
+}
+
+//edge trigger : keep reading into chained blocks until EAGAIN (a short read may still be followed by eof).
+//stop early when the budget is used up or the ring buffer is full (never evict for read ahead),
+//and leave s->drain set so the socket will be re-drained later.
+static void
+_drain_more(struct mread_pool * self, struct socket * s) {
+	struct ringbuffer * rb = self->rb;
+	int i;
+	for (i=1;i<DRAINBLOCK;i++) {
+		if (self->backpressure && ringbuffer_space(rb) < self->low_free) {
+			return;
+		}
+		int length = 0;
+		struct ringbuffer_block * blk = _expand_tail(rb, s, READBLOCKSIZE, &length);
+		if (blk == NULL) {
+			blk = ringbuffer_alloc(rb, READBLOCKSIZE);
+			if (blk == NULL) {
+				++self->stat.alloc_fail;
+				return;
+			}
+		}
+		int bytes;
+		do {
+			bytes = recv(s->fd, (char *)(blk + 1) + length, READBLOCKSIZE, MSG_DONTWAIT);
+			++self->stat.recv;
+		} while (bytes == -1 && errno == EINTR);
+		MREAD_TRACE_EVENT(MREAD_TRACE_RECV, self->active, bytes);
+		if (bytes <= 0) {
+			ringbuffer_shrink(rb, blk, length);
+            //eof or error will be met again by the next recv and close the socket there
+			if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				s->drain = 0;
+			}
+			return;
+		}
+		ringbuffer_shrink(rb, blk, length + bytes);
+		_link_node(rb, self->active, s, blk);
+		_received(self, s, bytes);
+	}
+}
+
+#ifdef __linux__
+#define _recvmmsg(fd, msg, n) recvmmsg(fd, msg, n, MSG_DONTWAIT, NULL)
+#else
+static int
+_recvmmsg(int fd, struct mmsghdr * msg, int n) {
+	int i;
+	for (i=0;i<n;i++) {
+		ssize_t r = recvmsg(fd, &msg[i].msg_hdr, MSG_DONTWAIT);
+		if (r < 0) {
+			return i > 0 ? i : -1;
+		}
+		msg[i].msg_len = r;
+	}
+	return n;
+}
+#endif
 
-    printf("mread_pull ...\n");
+//the segment size of a gro datagram , 0 if it's not coalesced
+static int
+_gro_size(struct msghdr * h) {
+#ifdef UDP_GRO
+	struct cmsghdr * c;
+	for (c = CMSG_FIRSTHDR(h); c; c = CMSG_NXTHDR(h, c)) {
+		if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+			int size;
+			memcpy(&size, CMSG_DATA(c), sizeof(size));
+			return size;
+		}
+	}
+#endif
+	return 0;
+}
+
+static void
+_datagram_source(struct mread_udp_source * src, const struct sockaddr_storage * ss) {
+	memset(src, 0, sizeof(*src));
+	src->family = ss->ss_family;
+	if (ss->ss_family == AF_INET6) {
+		const struct sockaddr_in6 * in6 = (const struct sockaddr_in6 *)ss;
+		src->port = ntohs(in6->sin6_port);
+		memcpy(src->addr, &in6->sin6_addr, 16);
+	} else if (ss->ss_family == AF_INET) {
+		const struct sockaddr_in * in = (const struct sockaddr_in *)ss;
+		src->port = ntohs(in->sin_port);
+		memcpy(src->addr, &in->sin_addr, 4);
+	}
+}
+
+//udp : one recvmmsg straight into a block , the datagrams are read into slots and packed down into frames of
+//4 bytes of big endian length , the source (MREAD_UDP_SOURCE) and the payload. a slot keeps room for the headers
+//in front of its payload (for every segment of a gro datagram) , so packing never overwrites the data not moved
+//yet. return the datagrams read
+static int
+_datagram_read(struct mread_pool * self, struct socket * s) {
+	int id = s - self->sockets;
+	struct ringbuffer * rb = self->rb;
+	int head = 4 + (s->datagram & DGRAM_SOURCE ? sizeof(struct mread_udp_source) : 0);
+	int reserve = head;
+	int max = self->datagram_max;
+	if (s->datagram & DGRAM_GRO) {
+        //a gro datagram is up to 64k , its segments are no more than datagram_max each
+		reserve = head * DGRAMGROSEGS;
+		max = DGRAMGROSIZE;
+	}
+	int slot = reserve + max;
+	int n = DGRAMBLOCK / slot;
+	if (n > DGRAMBATCH) {
+		n = DGRAMBATCH;
+	} else if (n < 1) {
+		n = 1;
+	}
+	int length = 0;
+	struct ringbuffer_block * blk = _expand_tail(rb, s, n * slot, &length);
+	while (blk == NULL && n > 1) {
+		blk = ringbuffer_alloc(rb, n * slot);
+		if (blk == NULL) {
+			n /= 2;
+		}
+	}
+	if (blk == NULL) {
+        //no room for a batch , collect only for one datagram
+		blk = _alloc_block(self, id, slot);
+		if (blk == NULL) {
+			s->status = SOCKET_SUSPEND;
+			return 0;
+		}
+	}
+	char * base = (char *)(blk + 1) + length;
+	struct mmsghdr msg[DGRAMBATCH];
+	struct iovec iov[DGRAMBATCH];
+	struct sockaddr_storage from[DGRAMBATCH];
+	char control[DGRAMBATCH][CMSG_SPACE(sizeof(int))];
+	int i;
+	for (i=0;i<n;i++) {
+		iov[i].iov_base = base + i * slot + reserve;
+		iov[i].iov_len = max;
+		struct msghdr * h = &msg[i].msg_hdr;
+		memset(h, 0, sizeof(*h));
+		h->msg_iov = &iov[i];
+		h->msg_iovlen = 1;
+		if (s->datagram & DGRAM_SOURCE) {
+			h->msg_name = &from[i];
+			h->msg_namelen = sizeof(from[i]);
+		}
+		if (s->datagram & DGRAM_GRO) {
+			h->msg_control = control[i];
+			h->msg_controllen = sizeof(control[i]);
+		}
+	}
+	int got;
+	do {
+		got = _recvmmsg(s->fd, msg, n);
+		++self->stat.recv;
+	} while (got == -1 && errno == EINTR);
+	MREAD_TRACE_EVENT(MREAD_TRACE_RECV, id, got);
+	if (got <= 0) {
+        //EAGAIN , or an error queued by icmp , the socket stays
+		ringbuffer_shrink(rb, blk, length);
+		s->status = SOCKET_SUSPEND;
+		s->drain = 0;
+		return 0;
+	}
+	char * w = base;
+	int bytes = 0;
+	for (i=0;i<got;i++) {
+		char * p = iov[i].iov_base;
+		int size = msg[i].msg_len;
+		if (msg[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            //larger than datagram_max , dropped as a frame too large
+			++self->stat.reject;
+			continue;
+		}
+		int seg = s->datagram & DGRAM_GRO ? _gro_size(&msg[i].msg_hdr) : 0;
+		if (seg <= 0 || seg > size) {
+			seg = size;
+		}
+		if (seg > self->datagram_max) {
+			++self->stat.reject;
+			continue;
+		}
+		struct mread_udp_source src;
+		if (s->datagram & DGRAM_SOURCE) {
+			_datagram_source(&src, &from[i]);
+		}
+        //an empty datagram is an empty frame
+		do {
+			int k = size < seg ? size : seg;
+			uint32_t len = k + head - 4;
+			w[0] = len >> 24;
+			w[1] = len >> 16;
+			w[2] = len >> 8;
+			w[3] = len;
+			if (s->datagram & DGRAM_SOURCE) {
+				memcpy(w + 4, &src, sizeof(src));
+			}
+			memmove(w + head, p, k);
+			w += head + k;
+			p += k;
+			size -= k;
+			bytes += k;
+			++self->stat.datagram;
+		} while (size > 0);
+	}
+	ringbuffer_shrink(rb, blk, length + (int)(w - base));
+	if (w == base) {
+        //all dropped
+		s->status = SOCKET_SUSPEND;
+		if (self->edge_trigger && got == n) {
+			_drain_push(self, s);
+		}
+		return 0;
+	}
+	_received(self, s, bytes);
+	_link_node(rb, id, s, blk);
+	s->status = SOCKET_READ;
+    //edge trigger : a full batch may leave more in the kernel
+	s->drain = self->edge_trigger && got == n;
+	return got;
+}
+
+//get data , recv only if more
+static void *
+_pull(struct mread_pool * self , int size , int more) {
 
+	MREAD_DEBUG("MREAD pull %d %d\n", self->active, size);
 	if (self->active == -1) {
 		return NULL;
 	}
@@ -531,18 +2920,42 @@ mread_pull(struct mread_pool * self , int size) {
 	int rd_size = size;                                    //read size
 	char * buffer = _ringbuffer_read(self, &rd_size);
 	if (buffer) {                                          //if buffer read
-
-        printf("buffer read \n");
-
 		self->skip += size;
+		++self->socket_stat[self->active].pull;
 		return buffer;
 	}
 
-    printf("buffer not read \n");
+	if (rd_size == size) {
+		return _read_temp(self, size, more);
+	}
+	if (!more) {
+		return NULL;
+	}
+
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		if (s->held_head >= 0) {
+            //a socket holding a part of the data pulled may collect for the rest , like a read with backpressure
+			if (_uring_unhold(self, s, s->node != NULL) > 0) {
+				return _pull(self, size, more);
+			}
+			if (s->status >= SOCKET_ALIVE) {
+                //no room , it's polled again when the held buffers are copied in
+				s->status = SOCKET_SUSPEND;
+				s->drain = 0;
+				return NULL;
+			}
+		}
+		return _uring_pull_end(self, s);
+	}
+#endif
 
 	switch (s->status) {                                   //if buffer not read
 	case SOCKET_READ:
 		s->status = SOCKET_SUSPEND;
+		if (s->drain) {
+			_drain_push(self, s);
+		}
 	case SOCKET_CLOSED:
 	case SOCKET_SUSPEND:
 		return NULL;
@@ -551,6 +2964,13 @@ mread_pull(struct mread_pool * self , int size) {
 		break;
 	}
 
+	if (s->datagram) {
+        //the datagrams are whole frames , nothing more is read for this pull
+		if (_datagram_read(self, s) == 0) {
+			return NULL;
+		}
+		return _pull(self, size, 0);
+	}
 
 	int sz = size - rd_size;	//sz is size to read
 	int rd = READBLOCKSIZE;
@@ -561,45 +2981,66 @@ mread_pull(struct mread_pool * self , int size) {
 	int id = self->active;
 	struct ringbuffer * rb = self->rb;
 
-	struct ringbuffer_block * blk = ringbuffer_alloc(rb , rd);
-	while (blk == NULL) {
-		int collect_id = ringbuffer_collect(rb);
-		mread_close_client(self , collect_id);
-		if (id == collect_id) {
+	int length = 0;
+	struct ringbuffer_block * blk = _expand_tail(rb, s, rd, &length);
+	if (blk == NULL && self->backpressure && !s->paused &&
+		((s->node == NULL && self->pause_count + 1 < self->stat.connection) || self->span_count > 0)) {
+        //backpressure : stop reading it when the ring buffer is low or full , unless it's the last one reading.
+        //only a socket holds nothing in the ring buffer , the others need more data to release their blocks.
+        //while spans are out , their release makes room , so any one may wait for it.
+        //a paused socket polled again has an error or hang up , let recv meet it
+		if (ringbuffer_space(rb) >= self->low_free) {
+			blk = ringbuffer_alloc(rb, rd);
+		}
+		if (blk == NULL) {
+			_pause(self, s);
+			return NULL;
+		}
+	}
+	if (blk == NULL) {
+		blk = _alloc_block(self, id, rd);
+		if (blk == NULL) {
 			return NULL;
 		}
-		blk = ringbuffer_alloc(rb , rd);
 	}
 
-	buffer = (char *)(blk + 1);
+	buffer = (char *)(blk + 1) + length;
 
 	for (;;) {
 		int bytes = recv(s->fd, buffer, rd, MSG_DONTWAIT);	//read bytes
+		++self->stat.recv;
+		MREAD_TRACE_EVENT(MREAD_TRACE_RECV, id, bytes);
 		if (bytes > 0) {
-			ringbuffer_shrink(rb, blk , bytes);
+			_received(self, s, bytes);
+			ringbuffer_shrink(rb, blk , length + bytes);
 			if (bytes < sz) {
 				_link_node(rb, self->active, s , blk);
 				s->status = SOCKET_SUSPEND;     //shift status,cuz byte not full 4
+				if (self->edge_trigger) {
+					_drain_push(self, s);       //read again until EAGAIN
+				}
 				return NULL;
 			}
 			s->status = SOCKET_READ;
+			s->drain = self->edge_trigger;
 			break;
 		}
 		if (bytes == 0) {
-			ringbuffer_shrink(rb, blk, 0);
+			ringbuffer_shrink(rb, blk, length);
 			_close_active(self);
 			return NULL;
 		}
 		if (bytes == -1) {
 			switch(errno) {
 			case EWOULDBLOCK:
-				ringbuffer_shrink(rb, blk, 0);
+				ringbuffer_shrink(rb, blk, length);
 				s->status = SOCKET_SUSPEND;
+				s->drain = 0;
 				return NULL;
 			case EINTR:
 				continue;
 			default:
-				ringbuffer_shrink(rb, blk, 0);
+				ringbuffer_shrink(rb, blk, length);
 				_close_active(self);
 				return NULL;
 			}
@@ -607,35 +3048,231 @@ mread_pull(struct mread_pool * self , int size) {
 	}
 
 	_link_node(rb, self->active , s , blk);
+	if (self->edge_trigger && s->drain) {
+		_drain_more(self, s);
+	}
 
 	void * ret;
 	int real_rd = ringbuffer_data(rb, s->node , size , self->skip, &ret);
 	if (ret) {
 		self->skip += size;
+		++self->socket_stat[self->active].pull;
 		return ret;     //return data address
 	}
 
     //ret null, real_rd >0 ,说明外部请求数据块在blk上不连续
 	assert(real_rd == size);
-	struct ringbuffer_block * temp = ringbuffer_alloc(rb, size);
-	while (temp == NULL) {
-		int collect_id = ringbuffer_collect(rb);
-		mread_close_client(self , collect_id);
-		if (id == collect_id) {
+	return _read_temp(self, size, 1);
+}
+
+void *
+mread_pull(struct mread_pool * self , int size) {
+	return _pull(self, size, 1);
+}
+
+static uint64_t
+_frame_length(const uint8_t * h, int header, int big_endian) {
+	uint64_t len = 0;
+	int i;
+	if (big_endian) {
+		for (i=0;i<header;i++) {
+			len = len << 8 | h[i];
+		}
+	} else {
+		for (i=header-1;i>=0;i--) {
+			len = len << 8 | h[i];
+		}
+	}
+	return len;
+}
+
+//peek the header first , then pull the whole frame , so nothing is consumed until the frame is complete
+static void *
+_pull_frame(struct mread_pool * self , int * size , int more) {
+	struct socket * s = &self->sockets[self->active];
+	int header = s->frame_header;
+	if (header == 0) {
+		return NULL;
+	}
+	uint8_t * h = _pull(self, header, more);
+	if (h == NULL) {
+		return NULL;
+	}
+	self->skip -= header;
+	--self->socket_stat[self->active].pull;
+	uint64_t len = _frame_length(h, header, s->frame_big_endian);
+	if (len > (uint64_t)s->frame_max) {
+		if (more) {
+            //reject it before the body fills the ring buffer
+			++self->stat.reject;
+			MREAD_ERROR("MREAD frame of %d too large %llu\n", self->active, (unsigned long long)len);
+			_close_active(self);
+		}
+		return NULL;
+	}
+	char * frame = _pull(self, header + (int)len, more);
+	if (frame == NULL) {
+		return NULL;
+	}
+	*size = (int)len;
+	return frame + header;
+}
+
+void *
+mread_pull_frame(struct mread_pool * self , int * size) {
+	if (self->active == -1) {
+		return NULL;
+	}
+	return _pull_frame(self, size, 1);
+}
+
+//the frames after the first one are the ones buffered already , they are pulled without collect (a frame which
+//needs a temp block and finds no room ends the batch , it's the first one of the next call) , so none of them is
+//freed before yield
+int
+mread_pull_frames(struct mread_pool * self , struct mread_frame * frames , int n) {
+	if (self->active == -1) {
+		return 0;
+	}
+	int i;
+	for (i=0;i<n;i++) {
+		frames[i].data = _pull_frame(self, &frames[i].size, i == 0);
+		if (frames[i].data == NULL) {
+			break;
+		}
+	}
+	return i;
+}
+
+//the first detach sets up the wakeup of the poll thread , return -1 if it can't
+static int
+_wake_init(struct mread_pool * self) {
+#ifdef HAVE_EPOLL
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+#ifdef HAVE_IO_URING
+	if (self->uring) {
+		self->wake_fd = fd;
+		self->wake = 1;
+		return 0;
+	}
+#endif
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = WAKESOCKET;
+	if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		close(fd);
+		return -1;
+	}
+	self->wake_fd = fd;
+#elif HAVE_KQUEUE
+	struct kevent ke;
+	EV_SET(&ke, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, WAKESOCKET);
+	if (kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL) == -1) {
+		return -1;
+	}
+#endif
+	self->wake = 1;
+	return 0;
+}
+
+//any thread , after a release into the empty list
+static void
+_wake(struct mread_pool * self) {
+#ifdef HAVE_EPOLL
+	uint64_t v = 1;
+	if (write(self->wake_fd, &v, sizeof(v)) != sizeof(v)) {
+        //the counter is full , it's not read yet and the poll thread is woken anyway
+		return;
+	}
+#elif HAVE_KQUEUE
+	struct kevent ke;
+	EV_SET(&ke, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, WAKESOCKET);
+	kevent(self->kqueue_fd, &ke, 1, NULL, 0, NULL);
+#endif
+}
+
+//pin the block of the data just pulled , the pull is consumed by yield as usual (NULL when out of memory)
+static struct mread_span *
+_detach(struct mread_pool * self, void * data, int size) {
+	if (!self->wake && _wake_init(self) < 0) {
+		return NULL;
+	}
+	struct span * sp = self->span_free;
+	if (sp) {
+		self->span_free = sp->next;
+	} else {
+		sp = malloc(sizeof(*sp));
+		if (sp == NULL) {
 			return NULL;
 		}
-		temp = ringbuffer_alloc(rb , size);
 	}
-	temp->id = id;
+	struct socket * s = &self->sockets[self->active];
+	struct ringbuffer_block * blk = NULL;
 	if (s->temp) {
-		ringbuffer_link(rb, temp, s->temp);
+		blk = ringbuffer_pin(self->rb, s->temp, data);
 	}
-	s->temp = temp;
-	ret = ringbuffer_copy(rb, s->node, self->skip, temp);
-	assert(ret);
-	self->skip += size;
+	if (blk == NULL) {
+		blk = ringbuffer_pin(self->rb, s->node, data);
+	}
+	assert(blk);
+	sp->span.data = data;
+	sp->span.size = size;
+	sp->span.id = self->active;
+	sp->span.handle = mread_handle(self, self->active);
+	sp->span.next = NULL;
+	sp->blk = blk;
+	sp->pool = self;
+	sp->ref = 1;
+	++self->span_count;
+	++self->stat.detach;
+	return &sp->span;
+}
 
-	return ret;
+struct mread_span *
+mread_detach(struct mread_pool * self , int size) {
+	void * data = _pull(self, size, 1);
+	if (data == NULL) {
+		return NULL;
+	}
+	return _detach(self, data, size);
+}
+
+struct mread_span *
+mread_detach_frame(struct mread_pool * self) {
+	int size;
+	void * data = mread_pull_frame(self, &size);
+	if (data == NULL) {
+		return NULL;
+	}
+	return _detach(self, data, size);
+}
+
+//any thread
+void
+mread_span_retain(struct mread_span * span) {
+	struct span * sp = (struct span *)span;
+	__atomic_add_fetch(&sp->ref, 1, __ATOMIC_RELAXED);
+}
+
+//any thread , the last release pushes it to the pool and wakes the poll thread if the list was empty ,
+//the poll thread unpins it then
+void
+mread_span_release(struct mread_span * span) {
+	struct span * sp = (struct span *)span;
+	if (__atomic_sub_fetch(&sp->ref, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+	struct mread_pool * self = sp->pool;
+	struct span * head = __atomic_load_n(&self->span_released, __ATOMIC_RELAXED);
+	do {
+		sp->next = head;
+	} while (!__atomic_compare_exchange_n(&self->span_released, &head, sp, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	if (head == NULL) {
+		_wake(self);
+	}
 }
 
 void
@@ -647,18 +3284,34 @@ mread_yield(struct mread_pool * self) {
 	ringbuffer_free(self->rb , s->temp);
 	s->temp = NULL;
 	if (s->status == SOCKET_CLOSED && s->node == NULL) {
-		--self->closed;
-		s->status = SOCKET_INVALID;
-		s->fd = self->free_socket - self->sockets;
-		self->free_socket = s;
-		self->skip = 0;
-		self->active = -1;
+		_free_closed(self, s);
 	} else {
 		if (s->node) {
 			s->node = ringbuffer_yield(self->rb, s->node, self->skip);
 		}
+		if (self->deadline && self->skip > 0) {
+            //something is pulled , the read clock starts again for the rest
+			self->deadline[self->active].read = s->node ? self->now : 0;
+		}
 		self->skip = 0;
 		if (s->node == NULL) {
+			s->tail = NULL;
+            //edge trigger : the event (or the read ahead) is not consumed yet
+			if (self->edge_trigger && (s->drain || s->status == SOCKET_POLLIN)) {
+				s->status = SOCKET_SUSPEND;
+				_drain_push(self, s);
+			}
+#ifdef HAVE_IO_URING
+			if (self->uring) {
+				if (s->eof && s->status >= SOCKET_ALIVE) {
+                    //the peer closed while it was pulled , no completion comes any more , the next poll closes it
+					s->status = SOCKET_SUSPEND;
+					_drain_push(self, s);
+				} else {
+					_uring_resume(self, s);
+				}
+			}
+#endif
 			self->active = -1;
 		}
 	}
@@ -676,3 +3329,52 @@ mread_closed(struct mread_pool * self) {
 	}
 	return 0;
 }
+
+//pop up to max closed ids and free them , as mread_closed does for each
+int
+mread_closed_batch(struct mread_pool * self, int * ids, int max) {
+	int n = 0;
+	while (n < max && self->close_head >= 0) {
+		int id = self->close_head;
+		struct socket * s = &self->sockets[id];
+		_close_unlink(self, -1, s);
+		if (s->status == SOCKET_CLOSED) {
+			_free_closed(self, s);
+			ids[n++] = id;
+		}
+	}
+	return n;
+}
+
+//every counter (the ring buffer ones too) is kept on the fly , nothing is walked
+void
+mread_stats(struct mread_pool * self, struct mread_stats * stats) {
+	*stats = self->stat;
+	struct ringbuffer_stats rs;
+	ringbuffer_stats(self->rb, &rs);
+	stats->buffer_size = rs.size;
+	stats->buffer_max = rs.max;
+	stats->buffer_grow = rs.grow;
+	stats->buffer_release = rs.release;
+	stats->buffer_used = rs.used;
+	stats->buffer_peak = rs.peak;
+}
+
+//it walks the whole ring buffer , call it from the thread which polls m only
+void
+mread_buffer_free_runs(struct mread_pool * self, int * free_run, int * free_max) {
+	ringbuffer_free_runs(self->rb, free_run, free_max);
+}
+
+int
+mread_socket_stats(struct mread_pool * self, int id, struct mread_socket_stats * stats) {
+	if (id < 0 || id >= self->max_connection) {
+		return -1;
+	}
+	struct socket * s = &self->sockets[id];
+	if (s->status == SOCKET_INVALID) {
+		return -1;
+	}
+	*stats = self->socket_stat[id];
+	return 0;
+}
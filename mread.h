@@ -1,16 +1,148 @@
 #ifndef MREAD_H
 #define MREAD_H
 
+#include <stdint.h>
+#include <sys/uio.h>
+
 struct mread_pool;
 
+#define MREAD_BACKEND_POLL 0
+#define MREAD_BACKEND_URING 1
+
+#define MREAD_COLLECT_OLDEST 0
+#define MREAD_COLLECT_LARGEST 1
+#define MREAD_COLLECT_PRIORITY 2
+
+#define MREAD_FORWARD_SHUTDOWN 1
+
+#define MREAD_HUGEPAGE_THP 1
+#define MREAD_HUGEPAGE_HUGETLB 2
+
+#define MREAD_UDP_SOURCE 1
+#define MREAD_UDP_GRO 2
+
+#define MREAD_NUMA_NONE 0
+#define MREAD_NUMA_POLL 1
+#define MREAD_NUMA_NODE 2
+
+struct mread_option {
+	int reuseport;
+	int edge_trigger;
+	int backlog;
+	int accept_budget;
+	int backend;
+	int collect;
+	int backpressure;
+	int low_watermark;
+	int high_watermark;
+	int buffer_max;
+	int buffer_segment;
+	int buffer_idle;
+	int buffer_hugepage;
+	int buffer_numa;
+	int buffer_node;
+	int buffer_prefault;
+	int buffer_lock;
+	int frame_header;
+	int frame_big_endian;
+	int frame_max;
+	int read_queue;
+	int idle_timeout;
+	int read_timeout;
+	int busy_poll;
+	int busy_poll_socket;
+	int datagram_max;
+};
+
+struct mread_stats {
+	int connection;
+	uint64_t accept;
+	uint64_t refuse;
+	uint64_t close;
+	uint64_t wait;
+	uint64_t recv;
+	uint64_t bytes;
+	uint64_t send;
+	uint64_t send_bytes;
+	uint64_t forward;
+	uint64_t alloc_fail;
+	uint64_t collect;
+	uint64_t pause;
+	uint64_t copy;
+	uint64_t detach;
+	uint64_t datagram;
+	uint64_t reject;
+	uint64_t timeout;
+	uint64_t spin_hit;
+	uint64_t spin_us;
+	uint64_t sleep_us;
+	int buffer_size;
+	int buffer_max;
+	int buffer_grow;
+	int buffer_release;
+	int buffer_used;
+	int buffer_peak;
+};
+
+struct mread_frame {
+	void * data;
+	int size;
+};
+
+struct mread_span {
+	void * data;
+	int size;
+	int id;
+	uint64_t handle;
+	struct mread_span * next;
+};
+
+struct mread_udp_source {
+	uint16_t family;
+	uint16_t port;
+	uint8_t addr[16];
+};
+
+struct mread_socket_stats {
+	uint64_t bytes;
+	uint64_t pull;
+};
+
 struct mread_pool * mread_create(int port , int max , int buffer);
+struct mread_pool * mread_create_option(int port , int max , int buffer , const struct mread_option * opt);
+int mread_listen(struct mread_pool *m , const char *addr , int port , int budget);
+int mread_listen_fd(struct mread_pool *m , int fd , int budget);
+int mread_listener(struct mread_pool *m , int id);
+int mread_udp(struct mread_pool *m , const char *addr , int port , int flags);
+int mread_udp_fd(struct mread_pool *m , int fd , int flags);
 void mread_close(struct mread_pool *m);
 
 int mread_poll(struct mread_pool *m , int timeout);
+int mread_poll_batch(struct mread_pool *m , int *ids , int max , int timeout);
+int mread_select(struct mread_pool *m , int id);
 void * mread_pull(struct mread_pool *m , int size);
+void * mread_pull_frame(struct mread_pool *m , int *size);
+int mread_pull_frames(struct mread_pool *m , struct mread_frame *frames , int n);
+void mread_frame(struct mread_pool *m , int id , int header , int big_endian , int max);
+void mread_timeout(struct mread_pool *m , int id , int idle , int read);
+struct mread_span * mread_detach(struct mread_pool *m , int size);
+struct mread_span * mread_detach_frame(struct mread_pool *m);
+void mread_span_retain(struct mread_span *span);
+void mread_span_release(struct mread_span *span);
 void mread_yield(struct mread_pool *m);
 int mread_closed(struct mread_pool *m);
+int mread_closed_batch(struct mread_pool *m , int *ids , int max);
 void mread_close_client(struct mread_pool *m, int id);
 int mread_socket(struct mread_pool *m , int index);
+uint64_t mread_handle(struct mread_pool *m , int id);
+int mread_handle_id(struct mread_pool *m , uint64_t handle);
+int mread_send(struct mread_pool *m , int id , const void *buffer , int size);
+int mread_sendv(struct mread_pool *m , int id , const struct iovec *iov , int n);
+void mread_flush(struct mread_pool *m);
+int mread_forward(struct mread_pool *m , int id , int fd , int flags);
+void mread_priority(struct mread_pool *m , int id , int priority);
+void mread_stats(struct mread_pool *m, struct mread_stats *stats);
+void mread_buffer_free_runs(struct mread_pool *m, int *free_run, int *free_max);
+int mread_socket_stats(struct mread_pool *m, int id, struct mread_socket_stats *stats);
 
 #endif
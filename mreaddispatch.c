@@ -0,0 +1,352 @@
+#include "mreaddispatch.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHELINE 64
+//messages of one connection run in one turn , then it goes back to the end of a queue
+#define BUDGET 64
+//rounds of looking for work before a worker sleeps
+#define SPIN 64
+
+//the messages of a connection , an intrusive mpsc queue (Vyukov's) pushed by the poll thread , and the stub by the owner.
+//scheduled is set by the one which puts the connection into a run queue , and cleared by the worker running it
+//when it finds the queue empty , so a connection is owned by one worker at most and its messages run in order
+struct conn {
+	struct mread_span * head;        //the last pushed , written by the producer
+	struct mread_span * tail;        //the next to pop , written by the owner
+	struct mread_span stub;
+	int scheduled;
+} __attribute__((aligned(CACHELINE)));
+
+//connections ready to run. one thread pushes at bottom , any worker (the owner too) takes from top with a cas.
+//a connection is in one queue at most , so a queue as large as max never overflows
+struct runqueue {
+	uint64_t top __attribute__((aligned(CACHELINE)));
+	uint64_t bottom __attribute__((aligned(CACHELINE)));
+	struct conn ** slot;
+};
+
+//in is pushed by the poll thread , again by the worker for the connections out of budget
+struct worker {
+	struct runqueue in;
+	struct runqueue again;
+	struct mread_dispatch * d;
+	pthread_t thread;
+	int index;
+	unsigned seed;
+	struct mread_dispatch_stats stat;
+} __attribute__((aligned(CACHELINE)));
+
+struct mread_dispatch {
+	int n;
+	int max;
+	int mask;
+	mread_dispatch_func func;
+	void * ud;
+	struct conn * conn;
+	struct worker * worker;
+	int quit;
+	int sleepers;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void
+_mailbox_push(struct conn * c, struct mread_span * span) {
+	span->next = NULL;
+	struct mread_span * prev = __atomic_exchange_n(&c->head, span, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&prev->next, span, __ATOMIC_RELEASE);
+}
+
+//NULL if it's empty , or the producer is in the middle of a push
+static struct mread_span *
+_mailbox_pop(struct conn * c) {
+	struct mread_span * tail = c->tail;
+	struct mread_span * next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &c->stub) {
+		if (next == NULL)
+			return NULL;
+		c->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		c->tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&c->head, __ATOMIC_SEQ_CST))
+		return NULL;
+	_mailbox_push(c, &c->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		c->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+static int
+_rq_init(struct runqueue * q, int size) {
+	q->top = 0;
+	q->bottom = 0;
+	q->slot = malloc(size * sizeof(struct conn *));
+	return q->slot == NULL ? -1 : 0;
+}
+
+//free the run queues of the workers from .. nthreads - 1
+static void
+_rq_free(struct mread_dispatch * d, int from, int nthreads) {
+	int i;
+	for (i=from;i<nthreads;i++) {
+		free(d->worker[i].in.slot);
+		free(d->worker[i].again.slot);
+	}
+}
+
+static void
+_rq_push(struct runqueue * q, int mask, struct conn * c) {
+	uint64_t b = q->bottom;
+	__atomic_store_n(&q->slot[b & mask], c, __ATOMIC_RELAXED);
+	__atomic_store_n(&q->bottom, b + 1, __ATOMIC_SEQ_CST);
+}
+
+//a slot read with a stale top may be overwritten , but its cas fails then
+static struct conn *
+_rq_take(struct runqueue * q, int mask) {
+	for (;;) {
+		uint64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+		uint64_t b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+		if (t >= b)
+			return NULL;
+		struct conn * c = __atomic_load_n(&q->slot[t & mask], __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return c;
+	}
+}
+
+static int
+_rq_empty(struct runqueue * q) {
+	return __atomic_load_n(&q->top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+}
+
+//pushers check sleepers after the push , sleepers check the queues after they are counted , so one of them sees
+//the other (both are seq_cst)
+static void
+_wakeup(struct mread_dispatch * d) {
+	if (__atomic_load_n(&d->sleepers, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&d->lock);
+		pthread_cond_signal(&d->cond);
+		pthread_mutex_unlock(&d->lock);
+	}
+}
+
+static int
+_has_work(struct mread_dispatch * d) {
+	int i;
+	for (i=0;i<d->n;i++) {
+		if (!_rq_empty(&d->worker[i].in) || !_rq_empty(&d->worker[i].again))
+			return 1;
+	}
+	return 0;
+}
+
+//the own queues first , then steal from the others , starting at a random one
+static struct conn *
+_next(struct mread_dispatch * d, struct worker * w) {
+	struct conn * c = _rq_take(&w->in, d->mask);
+	if (c == NULL) {
+		c = _rq_take(&w->again, d->mask);
+	}
+	if (c || d->n == 1)
+		return c;
+	int start = rand_r(&w->seed) % d->n;
+	int i;
+	for (i=0;i<d->n;i++) {
+		struct worker * v = &d->worker[(start + i) % d->n];
+		if (v == w)
+			continue;
+		c = _rq_take(&v->in, d->mask);
+		if (c == NULL) {
+			c = _rq_take(&v->again, d->mask);
+		}
+		if (c) {
+			++w->stat.steal;
+			return c;
+		}
+	}
+	return NULL;
+}
+
+//run the messages of c up to the budget. it's unscheduled when it's empty , unless a push comes in between
+static void
+_run(struct mread_dispatch * d, struct worker * w, struct conn * c) {
+	int n = 0;
+	for (;;) {
+		struct mread_span * span = _mailbox_pop(c);
+		if (span) {
+			d->func(span, w->index, d->ud);
+			mread_span_release(span);
+			++w->stat.run;
+			if (++n < BUDGET)
+				continue;
+			_rq_push(&w->again, d->mask, c);
+			_wakeup(d);
+			return;
+		}
+		//the tail is read before c may be taken by another worker
+		struct mread_span * tail = c->tail;
+		__atomic_store_n(&c->scheduled, 0, __ATOMIC_SEQ_CST);
+		if (tail == &c->stub && __atomic_load_n(&c->head, __ATOMIC_SEQ_CST) == &c->stub)
+			return;
+		int expect = 0;
+		if (!__atomic_compare_exchange_n(&c->scheduled, &expect, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+static void *
+_worker_main(void * ud) {
+	struct worker * w = ud;
+	struct mread_dispatch * d = w->d;
+	int idle = 0;
+	for (;;) {
+		struct conn * c = _next(d, w);
+		if (c) {
+			idle = 0;
+			_run(d, w, c);
+			continue;
+		}
+		if (++idle < SPIN) {
+			sched_yield();
+			continue;
+		}
+		pthread_mutex_lock(&d->lock);
+		__atomic_add_fetch(&d->sleepers, 1, __ATOMIC_SEQ_CST);
+		int quit = __atomic_load_n(&d->quit, __ATOMIC_SEQ_CST);
+		if (!_has_work(d) && !quit) {
+			++w->stat.sleep;
+			pthread_cond_wait(&d->cond, &d->lock);
+		}
+		__atomic_sub_fetch(&d->sleepers, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&d->lock);
+		if (quit && !_has_work(d))
+			break;
+		idle = 0;
+	}
+	return NULL;
+}
+
+//max is the max connection of the pool , the ids of the spans are below it. nthreads 0 for one per cpu
+struct mread_dispatch *
+mread_dispatch_create(int max, int nthreads, mread_dispatch_func func, void *ud) {
+	if (nthreads <= 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (int)ncpu : 1;
+	}
+	int size = 1;
+	while (size < max) {
+		size *= 2;
+	}
+	struct mread_dispatch * d = malloc(sizeof(*d));
+	if (d == NULL) {
+		return NULL;
+	}
+	if (posix_memalign((void **)&d->conn, CACHELINE, max * sizeof(struct conn))) {
+		free(d);
+		return NULL;
+	}
+	if (posix_memalign((void **)&d->worker, CACHELINE, nthreads * sizeof(struct worker))) {
+		free(d->conn);
+		free(d);
+		return NULL;
+	}
+	d->n = nthreads;
+	d->max = max;
+	d->mask = size - 1;
+	d->func = func;
+	d->ud = ud;
+	d->quit = 0;
+	d->sleepers = 0;
+	int i;
+	for (i=0;i<max;i++) {
+		struct conn * c = &d->conn[i];
+		c->stub.next = NULL;
+		c->head = &c->stub;
+		c->tail = &c->stub;
+		c->scheduled = 0;
+	}
+	memset(d->worker, 0, nthreads * sizeof(struct worker));
+	for (i=0;i<nthreads;i++) {
+		struct worker * w = &d->worker[i];
+		if (_rq_init(&w->in, size) || _rq_init(&w->again, size)) {
+			_rq_free(d, 0, i + 1);
+			free(d->worker);
+			free(d->conn);
+			free(d);
+			return NULL;
+		}
+		w->d = d;
+		w->index = i;
+		w->seed = i + 1;
+	}
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->cond, NULL);
+	for (i=0;i<nthreads;i++) {
+		if (pthread_create(&d->worker[i].thread, NULL, _worker_main, &d->worker[i]) != 0) {
+            //close frees the queues of the workers started
+			_rq_free(d, i, nthreads);
+			d->n = i;
+			mread_dispatch_close(d);
+			return NULL;
+		}
+	}
+	return d;
+}
+
+//the messages pushed already are run before the workers quit
+void
+mread_dispatch_close(struct mread_dispatch *d) {
+	if (d == NULL)
+		return;
+	pthread_mutex_lock(&d->lock);
+	__atomic_store_n(&d->quit, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->lock);
+	int i;
+	for (i=0;i<d->n;i++) {
+		pthread_join(d->worker[i].thread, NULL);
+	}
+	_rq_free(d, 0, d->n);
+	pthread_mutex_destroy(&d->lock);
+	pthread_cond_destroy(&d->cond);
+	free(d->worker);
+	free(d->conn);
+	free(d);
+}
+
+//the poll thread only. the connection goes to the queue of the worker of its id when it's not scheduled yet
+void
+mread_dispatch_push(struct mread_dispatch *d, struct mread_span *span) {
+	struct conn * c = &d->conn[span->id];
+	_mailbox_push(c, span);
+	int expect = 0;
+	if (__atomic_compare_exchange_n(&c->scheduled, &expect, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		_rq_push(&d->worker[span->id % d->n].in, d->mask, c);
+		_wakeup(d);
+	}
+}
+
+int
+mread_dispatch_size(struct mread_dispatch *d) {
+	return d->n;
+}
+
+//approximate while running
+void
+mread_dispatch_stats(struct mread_dispatch *d, int worker, struct mread_dispatch_stats *stats) {
+	*stats = d->worker[worker].stat;
+}
@@ -0,0 +1,28 @@
+#ifndef MREAD_DISPATCH_H
+#define MREAD_DISPATCH_H
+
+#include "mread.h"
+
+//the spans of mread_detach run on a pool of worker threads , in order for each connection , and one connection
+//on one worker at a time. idle workers steal connections from the others
+struct mread_dispatch;
+
+struct mread_dispatch_stats {
+	uint64_t run;
+	uint64_t steal;
+	uint64_t sleep;
+};
+
+typedef void (*mread_dispatch_func)(struct mread_span *span, int worker, void *ud);
+
+struct mread_dispatch * mread_dispatch_create(int max, int nthreads, mread_dispatch_func func, void *ud);
+
+void mread_dispatch_close(struct mread_dispatch *d);
+
+void mread_dispatch_push(struct mread_dispatch *d, struct mread_span *span);
+
+int mread_dispatch_size(struct mread_dispatch *d);
+
+void mread_dispatch_stats(struct mread_dispatch *d, int worker, struct mread_dispatch_stats *stats);
+
+#endif
@@ -0,0 +1,196 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "mreadgroup.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+//one shard is one pool driven by its own thread
+struct shard {
+	struct mread_group * group;
+	struct mread_pool * pool;
+	pthread_t thread;
+	int index;
+};
+
+struct mread_group {
+	int n;
+	volatile int quit;
+	int running;
+	mread_group_func func;
+	void * ud;
+	struct shard * shards;
+};
+
+//pin the calling thread to one cpu, shards wrap around when there are more threads than cpus
+static void
+_bind_cpu(int index) {
+#ifdef __linux__
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu <= 0) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(index % ncpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+static void *
+_shard_main(void * ud) {
+	struct shard * s = ud;
+	struct mread_group * g = s->group;
+	_bind_cpu(s->index);
+	while (!g->quit) {
+		g->func(s->pool, s->index, g->ud);
+	}
+	return NULL;
+}
+
+//every shard listens on the same port with SO_REUSEPORT, and owns its epoll set, socket table and ring buffer
+struct mread_group *
+mread_group_create(int port , int nthreads , int max , int buffer_size) {
+	if (nthreads <= 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (int)ncpu : 1;
+	}
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.reuseport = 1;
+	opt.buffer_numa = MREAD_NUMA_POLL;
+
+	struct mread_group * g = malloc(sizeof(*g));
+	g->n = nthreads;
+	g->quit = 0;
+	g->running = 0;
+	g->func = NULL;
+	g->ud = NULL;
+	g->shards = malloc(nthreads * sizeof(struct shard));
+
+	int i;
+	for (i=0;i<nthreads;i++) {
+		struct shard * s = &g->shards[i];
+		s->group = g;
+		s->index = i;
+		s->pool = mread_create_option(port, max, buffer_size, &opt);
+		if (s->pool == NULL) {
+			g->n = i;
+			mread_group_close(g);
+			return NULL;
+		}
+	}
+
+	return g;
+}
+
+void
+mread_group_close(struct mread_group *g) {
+	if (g == NULL)
+		return;
+	mread_group_stop(g);
+	int i;
+	for (i=0;i<g->n;i++) {
+		mread_close(g->shards[i].pool);
+	}
+	free(g->shards);
+	free(g);
+}
+
+int
+mread_group_size(struct mread_group *g) {
+	return g->n;
+}
+
+struct mread_pool *
+mread_group_pool(struct mread_group *g, int shard) {
+	if (shard < 0 || shard >= g->n)
+		return NULL;
+	return g->shards[shard].pool;
+}
+
+//func is called in a loop by each shard thread until mread_group_stop, it should poll with a finite timeout
+int
+mread_group_start(struct mread_group *g, mread_group_func func, void *ud) {
+	if (g->running) {
+		return -1;
+	}
+	g->quit = 0;
+	g->func = func;
+	g->ud = ud;
+	int i;
+	for (i=0;i<g->n;i++) {
+		struct shard * s = &g->shards[i];
+		if (pthread_create(&s->thread, NULL, _shard_main, s) != 0) {
+			g->quit = 1;
+			while (--i >= 0) {
+				pthread_join(g->shards[i].thread, NULL);
+			}
+			return -1;
+		}
+	}
+	g->running = 1;
+	return 0;
+}
+
+void
+mread_group_stop(struct mread_group *g) {
+	if (!g->running) {
+		return;
+	}
+	g->quit = 1;
+	int i;
+	for (i=0;i<g->n;i++) {
+		pthread_join(g->shards[i].thread, NULL);
+	}
+	g->running = 0;
+}
+
+static void
+_add_stats(struct mread_stats *total, const struct mread_stats *st) {
+	total->connection += st->connection;
+	total->accept += st->accept;
+	total->refuse += st->refuse;
+	total->close += st->close;
+	total->wait += st->wait;
+	total->recv += st->recv;
+	total->bytes += st->bytes;
+	total->send += st->send;
+	total->send_bytes += st->send_bytes;
+	total->forward += st->forward;
+	total->alloc_fail += st->alloc_fail;
+	total->collect += st->collect;
+	total->pause += st->pause;
+	total->copy += st->copy;
+	total->detach += st->detach;
+	total->datagram += st->datagram;
+	total->reject += st->reject;
+	total->timeout += st->timeout;
+	total->spin_hit += st->spin_hit;
+	total->spin_us += st->spin_us;
+	total->sleep_us += st->sleep_us;
+	total->buffer_size += st->buffer_size;
+	total->buffer_max += st->buffer_max;
+	total->buffer_grow += st->buffer_grow;
+	total->buffer_release += st->buffer_release;
+	total->buffer_used += st->buffer_used;
+	total->buffer_peak += st->buffer_peak;
+}
+
+//counters are read without locking, so the sum is approximate while shards are running
+void
+mread_group_stats(struct mread_group *g, struct mread_group_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	stats->shard = g->n;
+	int i;
+	for (i=0;i<g->n;i++) {
+		struct mread_stats st;
+		mread_stats(g->shards[i].pool, &st);
+		_add_stats(&stats->total, &st);
+	}
+}
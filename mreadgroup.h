@@ -0,0 +1,24 @@
+#ifndef MREAD_GROUP_H
+#define MREAD_GROUP_H
+
+#include "mread.h"
+
+struct mread_group;
+
+struct mread_group_stats {
+	int shard;
+	struct mread_stats total;
+};
+
+typedef void (*mread_group_func)(struct mread_pool *m, int shard, void *ud);
+
+struct mread_group * mread_group_create(int port , int nthreads , int max , int buffer);
+void mread_group_close(struct mread_group *g);
+
+int mread_group_size(struct mread_group *g);
+struct mread_pool * mread_group_pool(struct mread_group *g, int shard);
+int mread_group_start(struct mread_group *g, mread_group_func func, void *ud);
+void mread_group_stop(struct mread_group *g);
+void mread_group_stats(struct mread_group *g, struct mread_group_stats *stats);
+
+#endif
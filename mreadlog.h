@@ -0,0 +1,42 @@
+#ifndef MREAD_LOG_H
+#define MREAD_LOG_H
+
+//logs are compiled out unless MREAD_LOG_LEVEL is defined (-DMREAD_LOG_LEVEL=2)
+//1 error , 2 info (bind/connect/close) , 3 debug (every poll and pull)
+
+#ifndef MREAD_LOG_LEVEL
+#define MREAD_LOG_LEVEL 0
+#endif
+
+#if MREAD_LOG_LEVEL > 0
+#include <stdio.h>
+#define MREAD_LOG(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+#if MREAD_LOG_LEVEL >= 1
+#define MREAD_ERROR(...) MREAD_LOG(__VA_ARGS__)
+#else
+#define MREAD_ERROR(...) ((void)0)
+#endif
+
+#if MREAD_LOG_LEVEL >= 2
+#define MREAD_INFO(...) MREAD_LOG(__VA_ARGS__)
+#else
+#define MREAD_INFO(...) ((void)0)
+#endif
+
+#if MREAD_LOG_LEVEL >= 3
+#define MREAD_DEBUG(...) MREAD_LOG(__VA_ARGS__)
+#else
+#define MREAD_DEBUG(...) ((void)0)
+#endif
+
+//binary trace events are compiled in with -DMREAD_TRACE
+#ifdef MREAD_TRACE
+#include "mreadtrace.h"
+#define MREAD_TRACE_EVENT(type, id, arg) mread_trace_event(type, id, arg)
+#else
+#define MREAD_TRACE_EVENT(type, id, arg) ((void)0)
+#endif
+
+#endif
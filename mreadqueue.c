@@ -0,0 +1,80 @@
+#include "mreadqueue.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHELINE 64
+
+//head is written by the consumer only and tail by the producer only , each on its own cache line with the
+//copy of the other index it saw last , so the shared line is read again only when the queue looks full (empty)
+struct mread_queue {
+	uint64_t head __attribute__((aligned(CACHELINE)));
+	uint64_t tail_cache;
+	uint64_t tail __attribute__((aligned(CACHELINE)));
+	uint64_t head_cache;
+	int mask __attribute__((aligned(CACHELINE)));
+	void * slot[];
+};
+
+//size is rounded up to a power of 2
+struct mread_queue *
+mread_queue_new(int size) {
+	int cap = 1;
+	while (cap < size) {
+		cap *= 2;
+	}
+	struct mread_queue * q;
+	if (posix_memalign((void **)&q, CACHELINE, sizeof(*q) + cap * sizeof(void *))) {
+		return NULL;
+	}
+	q->head = 0;
+	q->tail_cache = 0;
+	q->tail = 0;
+	q->head_cache = 0;
+	q->mask = cap - 1;
+	return q;
+}
+
+void
+mread_queue_delete(struct mread_queue * q) {
+	free(q);
+}
+
+//producer , return -1 if it's full
+int
+mread_queue_push(struct mread_queue * q, void * p) {
+	uint64_t tail = q->tail;
+	if (tail - q->head_cache > (uint64_t)q->mask) {
+		q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+		if (tail - q->head_cache > (uint64_t)q->mask)
+			return -1;
+	}
+	q->slot[tail & q->mask] = p;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+//consumer , return NULL if it's empty
+void *
+mread_queue_pop(struct mread_queue * q) {
+	void * p;
+	return mread_queue_pop_batch(q, &p, 1) ? p : NULL;
+}
+
+//consumer , pop up to max with one store of head , return the number popped
+int
+mread_queue_pop_batch(struct mread_queue * q, void ** p, int max) {
+	uint64_t head = q->head;
+	if (q->tail_cache - head < (uint64_t)max) {
+		q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	}
+	int n = (int)(q->tail_cache - head < (uint64_t)max ? q->tail_cache - head : (uint64_t)max);
+	int i;
+	for (i=0;i<n;i++) {
+		p[i] = q->slot[(head + i) & q->mask];
+	}
+	if (n > 0) {
+		__atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);
+	}
+	return n;
+}
@@ -0,0 +1,18 @@
+#ifndef MREAD_QUEUE_H
+#define MREAD_QUEUE_H
+
+//a lock-free queue of pointers from one producer thread to one consumer thread (the spans of mread_detach
+//from the poll thread to a worker)
+struct mread_queue;
+
+struct mread_queue * mread_queue_new(int size);
+
+void mread_queue_delete(struct mread_queue * q);
+
+int mread_queue_push(struct mread_queue * q, void * p);
+
+void * mread_queue_pop(struct mread_queue * q);
+
+int mread_queue_pop_batch(struct mread_queue * q, void ** p, int max);
+
+#endif
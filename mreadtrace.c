@@ -0,0 +1,122 @@
+#include "mreadtrace.h"
+
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//a fixed ring of records shared by all pools (and threads). writers claim a slot with one atomic add
+//and publish it by storing seq last, readers skip the slots not published yet or overwritten.
+
+#define TRACE_SIZE 65536
+
+static struct mread_trace_record T[TRACE_SIZE];
+static uint64_t trace_index = 0;
+
+void
+mread_trace_event(int type, int id, int arg) {
+	uint64_t index = __atomic_fetch_add(&trace_index, 1, __ATOMIC_RELAXED);
+	struct mread_trace_record * r = &T[index & (TRACE_SIZE - 1)];
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	r->time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	r->type = type;
+	r->id = id;
+	r->arg = arg;
+	__atomic_store_n(&r->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+//copy the latest records (oldest first) , return the number copied
+int
+mread_trace_read(struct mread_trace_record * records, int max) {
+	uint64_t last = __atomic_load_n(&trace_index, __ATOMIC_ACQUIRE);
+	if (max > TRACE_SIZE) {
+		max = TRACE_SIZE;
+	}
+	uint64_t first = last > (uint64_t)max ? last - max : 0;
+	int n = 0;
+	uint64_t i;
+	for (i=first;i<last;i++) {
+		struct mread_trace_record * r = &T[i & (TRACE_SIZE - 1)];
+		if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != i + 1)
+			continue;
+		records[n] = *r;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != i + 1)
+			continue;
+		++n;
+	}
+	return n;
+}
+
+static const char * trace_name[] = {
+	"", "poll", "accept", "recv", "shrink", "collect", "close",
+};
+
+static char *
+_append(char * p, const char * str) {
+	while (*str) {
+		*p++ = *str++;
+	}
+	return p;
+}
+
+static char *
+_number(char * p, int64_t v) {
+	char tmp[24];
+	int n = 0;
+	uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+	if (v < 0) {
+		*p++ = '-';
+	}
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (n > 0) {
+		*p++ = tmp[--n];
+	}
+	return p;
+}
+
+//write the ring as text lines "time type id arg", only write(2) is used so it is safe in a signal handler
+void
+mread_trace_dump(int fd) {
+	uint64_t last = __atomic_load_n(&trace_index, __ATOMIC_ACQUIRE);
+	uint64_t first = last > TRACE_SIZE ? last - TRACE_SIZE : 0;
+	char line[128];
+	uint64_t i;
+	for (i=first;i<last;i++) {
+		struct mread_trace_record r = T[i & (TRACE_SIZE - 1)];
+		if (r.seq != i + 1 || r.type <= 0 || r.type > MREAD_TRACE_CLOSE)
+			continue;
+		char * p = line;
+		p = _number(p, r.time);
+		*p++ = ' ';
+		p = _append(p, trace_name[r.type]);
+		*p++ = ' ';
+		p = _number(p, r.id);
+		*p++ = ' ';
+		p = _number(p, r.arg);
+		*p++ = '\n';
+		if (write(fd, line, p - line) < 0)
+			return;
+	}
+}
+
+static void
+_dump_handler(int sig) {
+	mread_trace_dump(STDERR_FILENO);
+}
+
+//dump the ring to stderr when sig (SIGUSR1 for example) is received
+int
+mread_trace_signal(int sig) {
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _dump_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	return sigaction(sig, &sa, NULL);
+}
@@ -0,0 +1,30 @@
+#ifndef MREAD_TRACE_H
+#define MREAD_TRACE_H
+
+#include <stdint.h>
+
+#define MREAD_TRACE_POLL 1
+#define MREAD_TRACE_ACCEPT 2
+#define MREAD_TRACE_RECV 3
+#define MREAD_TRACE_SHRINK 4
+#define MREAD_TRACE_COLLECT 5
+#define MREAD_TRACE_CLOSE 6
+
+struct mread_trace_record {
+	uint64_t time;      //CLOCK_MONOTONIC nanoseconds
+	uint64_t seq;       //index + 1 when the record is complete
+	int type;
+	int id;
+	int arg;
+	int pad;
+};
+
+void mread_trace_event(int type, int id, int arg);
+
+int mread_trace_read(struct mread_trace_record * records, int max);
+
+void mread_trace_dump(int fd);
+
+int mread_trace_signal(int sig);
+
+#endif
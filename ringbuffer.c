@@ -1,28 +1,71 @@
 #include "ringbuffer.h"
+#include "mreadlog.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
 
 #define M sizeof(int)
 #define ALIGN(s) (((s) + M-1 ) & ~(M-1))
+//max blocks in use an alloc steps over
+#define SKIPBLOCK 16
+//the sizes are rounded up to it with RINGBUFFER_HUGEPAGE / RINGBUFFER_HUGETLB
+#define HUGEPAGE (2 * 1024 * 1024)
+
+struct ringbuffer_owner {
+	int head;      //offset of the oldest block of the id , -1 if it owns nothing
+	int count;
+	int bytes;     //aligned bytes of the blocks
+	int priority;
+	int heap;      //index in the victim heap , -1 if it's not in
+	int older;     //the ids owning something , in the order they started to
+	int newer;
+};
 
 struct ringbuffer {
-	int size;
+	char * base;   //max bytes of address space are reserved , the blocks are in the first size bytes
+	int size;      //bytes in use now , it grows by segment up to max when an alloc fails , and shrinks back to min
+	int min;
+	int max;
+	int segment;
+	int mapped;    //bytes made accessible , the ones over size are given back to the os
+	int page;      //the sizes are aligned to it
+	int reserved;  //bytes of address space from base
+	int populate;  //0 , or the segments in use are faulted in (1) or locked (2) , see ringbuffer_populate
+	int idle;      //free bytes at the end found by the last ringbuffer_release
+	int * seg_used;   //bytes in use in each segment over min , the free ones at the end are released
+	int * seg_block;  //offset of the block holding the first byte of each segment over min
+	int grow;
+	int release;
 	int head;      //head is sum of length of all allocated blk, it's the index
+	int used;      //aligned bytes of the blocks given by alloc and not released yet
+	int peak;      //high water mark of used
+	int policy;    //RINGBUFFER_COLLECT_*
+	int blocker;   //offset of the block which stopped the last failed alloc , -1 if the layout changed since
+	int owner_cap;
+	struct ringbuffer_owner * owner;
+	int * heap;    //the ids owning something , the victim of RINGBUFFER_COLLECT_LARGEST / PRIORITY on top
+	int heap_len;  //0 with RINGBUFFER_COLLECT_OLDEST , the heap is not kept then
+	int oldest;    //the ids owning something , from the one owning the longest
+	int newest;
 };
 
 //get offset of given blk
 static inline int
 block_offset(struct ringbuffer * rb, struct ringbuffer_block * blk) {
-	char * start = (char *)(rb + 1);
-	return (char *)blk - start;
+	return (char *)blk - rb->base;
 }
 
 static inline struct ringbuffer_block *
 block_ptr(struct ringbuffer * rb, int offset) {
-	char * start = (char *)(rb + 1);                                   //jump over struct its self , to data seg [struct_self-data]
-	return (struct ringbuffer_block *)(start + offset);
+	return (struct ringbuffer_block *)(rb->base + offset);
 }
 
 static inline struct ringbuffer_block *
@@ -37,25 +80,446 @@ block_next(struct ringbuffer * rb, struct ringbuffer_block * blk) {
 	return block_ptr(rb, head + align_length);      //offset of last bulk + length of last bulk
 }
 
-struct ringbuffer *
-ringbuffer_new(int size) {
-	struct ringbuffer * rb = malloc(sizeof(*rb) + size);
+//length bytes at offset are in use (length < 0 : not any more) , count them in the segments over min
+static void
+_use(struct ringbuffer * rb, int offset, int length) {
+	rb->used += length;
+	if (rb->segment == 0)
+		return;
+	int sign = 1;
+	if (length < 0) {
+		sign = -1;
+		length = -length;
+	}
+	int end = offset + length;
+	if (offset < rb->min) {
+		offset = rb->min;
+	}
+	while (offset < end) {
+		int index = (offset - rb->min) / rb->segment;
+		int seg_end = rb->min + (index + 1) * rb->segment;
+		int n = (end < seg_end ? end : seg_end) - offset;
+		rb->seg_used[index] += sign * n;
+		offset += n;
+	}
+}
 
-    printf("size of init rb is %d \n", sizeof(*rb));
+//a block of length bytes is laid at offset , it holds the first bytes of the segments starting in it
+static void
+_lay(struct ringbuffer * rb, int offset, int length) {
+	if (rb->segment == 0)
+		return;
+	int end = offset + length;
+	int index = offset <= rb->min ? 0 : (offset - rb->min + rb->segment - 1) / rb->segment;
+	int start;
+	while ((start = rb->min + index * rb->segment) < end && start < rb->max) {
+		rb->seg_block[index++] = offset;
+	}
+}
+
+static int
+_page_align(int size, int page) {
+	return (size + page - 1) / page * page;
+}
 
+//reserve size bytes of address space , aligned to the huge page for RINGBUFFER_HUGEPAGE
+static char *
+_reserve(int size, int flags) {
+	if (flags & RINGBUFFER_HUGETLB) {
+#ifdef MAP_HUGETLB
+        //the huge pages of the whole reserve come from the pool (vm.nr_hugepages) now , or it fails
+		char * base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB, -1, 0);
+		if (base != MAP_FAILED) {
+			return base;
+		}
+#endif
+		MREAD_INFO("MREAD no huge pages for the ring buffer , use transparent huge pages\n");
+		flags |= RINGBUFFER_HUGEPAGE;
+	}
+	if (!(flags & RINGBUFFER_HUGEPAGE)) {
+		char * base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+		return base == MAP_FAILED ? NULL : base;
+	}
+	char * base = mmap(NULL, size + HUGEPAGE, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+	int head = (HUGEPAGE - (uintptr_t)base % HUGEPAGE) % HUGEPAGE;
+	if (head > 0) {
+		munmap(base, head);
+	}
+	munmap(base + head + size, HUGEPAGE - head);
+	base += head;
+#ifdef MADV_HUGEPAGE
+	madvise(base, size, MADV_HUGEPAGE);
+#endif
+	return base;
+}
+
+//size bytes at first , grows by segment bytes up to max. the address space of max is reserved at once ,
+//so the offsets and the pointers of the blocks never move
+struct ringbuffer *
+ringbuffer_new_memory(int size, int max, int segment, int flags) {
+	int page = flags & (RINGBUFFER_HUGEPAGE | RINGBUFFER_HUGETLB) ? HUGEPAGE : sysconf(_SC_PAGESIZE);
+	if (page == HUGEPAGE) {
+		size = _page_align(size, page);
+	}
+	if (max > size) {
+		if (segment <= 0) {
+			segment = size;
+		}
+		segment = _page_align(segment, page);
+		size = _page_align(size, page);
+		max = size + (max - size + segment - 1) / segment * segment;
+	} else {
+		max = size;
+		segment = 0;
+	}
+	int mapped = _page_align(size, page);
+	int reserved = _page_align(max, page);
+	char * base = _reserve(reserved, flags);
+	if (base == NULL) {
+		return NULL;
+	}
+	if (mprotect(base, mapped, PROT_READ | PROT_WRITE) == -1) {
+		munmap(base, reserved);
+		return NULL;
+	}
+	struct ringbuffer * rb = malloc(sizeof(*rb));
+	int * seg = NULL;
+	if (segment > 0) {
+		seg = calloc(2 * ((max - size) / segment), sizeof(int));
+	}
+	if (rb == NULL || (segment > 0 && seg == NULL)) {
+		free(rb);
+		free(seg);
+		munmap(base, reserved);
+		return NULL;
+	}
+	MREAD_DEBUG("MREAD ring buffer %d bytes , max %d\n", size, max);
+
+	rb->base = base;
 	rb->size = size;
+	rb->min = size;
+	rb->max = max;
+	rb->segment = segment;
+	rb->mapped = mapped;
+	rb->page = page;
+	rb->reserved = reserved;
+	rb->populate = 0;
+	rb->idle = 0;
+	rb->seg_used = seg;
+	rb->seg_block = segment > 0 ? seg + (max - size) / segment : NULL;
+	rb->grow = 0;
+	rb->release = 0;
 	rb->head = 0;
+	rb->used = 0;
+	rb->peak = 0;
+	rb->policy = RINGBUFFER_COLLECT_OLDEST;
+	rb->blocker = -1;
+	rb->owner_cap = 0;
+	rb->owner = NULL;
+	rb->heap = NULL;
+	rb->heap_len = 0;
+	rb->oldest = -1;
+	rb->newest = -1;
 	struct ringbuffer_block * blk = block_ptr(rb, 0);   //get address of memory
 	blk->length = size;
 	blk->id = -1;
 	return rb;
 }
 
+struct ringbuffer *
+ringbuffer_new_range(int size, int max, int segment) {
+	return ringbuffer_new_memory(size, max, segment, 0);
+}
+
+struct ringbuffer *
+ringbuffer_new(int size) {
+	return ringbuffer_new_range(size, size, 0);
+}
+
 void
 ringbuffer_delete(struct ringbuffer * rb) {
+	munmap(rb->base, rb->reserved);
+	free(rb->owner);
+	free(rb->heap);
+	free(rb->seg_used);
 	free(rb);
 }
 
+//fault in the pages of [offset, offset + size) , or lock them
+static int
+_populate(struct ringbuffer * rb, int offset, int size) {
+	char * p = rb->base + offset;
+	if (rb->populate == 2) {
+		return mlock(p, size);
+	}
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(p, size, MADV_POPULATE_WRITE) == 0) {
+		return 0;
+	}
+#endif
+	volatile char * v = p;
+	int page = sysconf(_SC_PAGESIZE);
+	int i;
+	for (i=0;i<size;i+=page) {
+		v[i] = v[i];
+	}
+	return 0;
+}
+
+//fault in (lock 0) or lock (lock 1) the memory in use , and the segments it grows later , so the reads never wait
+//for a page fault. return -1 if mlock fails (RLIMIT_MEMLOCK) , the pages are faulted in then
+int
+ringbuffer_populate(struct ringbuffer * rb, int lock) {
+	rb->populate = lock ? 2 : 1;
+	if (_populate(rb, 0, rb->size) == 0) {
+		return 0;
+	}
+	rb->populate = 1;
+	_populate(rb, 0, rb->size);
+	return -1;
+}
+
+//prefer the numa node (-1 : the node of the calling thread) for the whole reserve , the pages touched already are
+//moved to it. return -1 if it's not supported
+int
+ringbuffer_bind(struct ringbuffer * rb, int node) {
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+	if (node < 0) {
+		unsigned cpu, n;
+		if (syscall(SYS_getcpu, &cpu, &n, NULL) == -1) {
+			return -1;
+		}
+		node = (int)n;
+	}
+	unsigned long mask[16];
+	if (node >= (int)(sizeof(mask) * 8)) {
+		return -1;
+	}
+	memset(mask, 0, sizeof(mask));
+	mask[node / (sizeof(mask[0]) * 8)] = 1UL << (node % (sizeof(mask[0]) * 8));
+	if (syscall(SYS_mbind, rb->base, (unsigned long)rb->reserved, MPOL_PREFERRED, mask,
+		(unsigned long)(sizeof(mask) * 8), MPOL_MF_MOVE) == -1) {
+		return -1;
+	}
+	MREAD_DEBUG("MREAD ring buffer on node %d\n", node);
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+//id a is collected before id b : the lower priority (RINGBUFFER_COLLECT_PRIORITY) , the more bytes , the lower id
+static int
+_before(struct ringbuffer * rb, int a, int b) {
+	struct ringbuffer_owner * oa = &rb->owner[a];
+	struct ringbuffer_owner * ob = &rb->owner[b];
+	if (rb->policy == RINGBUFFER_COLLECT_PRIORITY && oa->priority != ob->priority) {
+		return oa->priority < ob->priority;
+	}
+	if (oa->bytes != ob->bytes) {
+		return oa->bytes > ob->bytes;
+	}
+	return a < b;
+}
+
+static void
+_heap_set(struct ringbuffer * rb, int index, int id) {
+	rb->heap[index] = id;
+	rb->owner[id].heap = index;
+}
+
+//move id up or down to its place after its key changed
+static void
+_heap_fix(struct ringbuffer * rb, int id) {
+	int index = rb->owner[id].heap;
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+		if (!_before(rb, id, rb->heap[parent]))
+			break;
+		_heap_set(rb, index, rb->heap[parent]);
+		index = parent;
+	}
+	for (;;) {
+		int child = index * 2 + 1;
+		if (child >= rb->heap_len)
+			break;
+		if (child + 1 < rb->heap_len && _before(rb, rb->heap[child + 1], rb->heap[child])) {
+			++child;
+		}
+		if (!_before(rb, rb->heap[child], id))
+			break;
+		_heap_set(rb, index, rb->heap[child]);
+		index = child;
+	}
+	_heap_set(rb, index, id);
+}
+
+static void
+_heap_update(struct ringbuffer * rb, int id) {
+	if (rb->owner[id].heap >= 0) {
+		_heap_fix(rb, id);
+	}
+}
+
+static void
+_heap_push(struct ringbuffer * rb, int id) {
+	if (rb->policy == RINGBUFFER_COLLECT_OLDEST)
+		return;
+	_heap_set(rb, rb->heap_len++, id);
+	_heap_fix(rb, id);
+}
+
+static void
+_heap_remove(struct ringbuffer * rb, int id) {
+	int index = rb->owner[id].heap;
+	if (index < 0)
+		return;
+	rb->owner[id].heap = -1;
+	int last = rb->heap[--rb->heap_len];
+	if (last != id) {
+		_heap_set(rb, index, last);
+		_heap_fix(rb, last);
+	}
+}
+
+//id starts to own something , or owns nothing any more
+static void
+_owner_add(struct ringbuffer * rb, int id) {
+	struct ringbuffer_owner * o = &rb->owner[id];
+	o->older = rb->newest;
+	o->newer = -1;
+	if (rb->newest >= 0) {
+		rb->owner[rb->newest].newer = id;
+	} else {
+		rb->oldest = id;
+	}
+	rb->newest = id;
+	_heap_push(rb, id);
+}
+
+static void
+_owner_remove(struct ringbuffer * rb, int id) {
+	struct ringbuffer_owner * o = &rb->owner[id];
+	if (o->older >= 0) {
+		rb->owner[o->older].newer = o->newer;
+	} else {
+		rb->oldest = o->newer;
+	}
+	if (o->newer >= 0) {
+		rb->owner[o->newer].older = o->older;
+	} else {
+		rb->newest = o->older;
+	}
+	_heap_remove(rb, id);
+}
+
+//the heap is only kept for the policies which need it , it's built again when the policy changes
+void
+ringbuffer_policy(struct ringbuffer * rb, int policy) {
+	rb->policy = policy;
+	int i;
+	for (i=0;i<rb->heap_len;i++) {
+		rb->owner[rb->heap[i]].heap = -1;
+	}
+	rb->heap_len = 0;
+	int id;
+	for (id=rb->oldest;id>=0;id=rb->owner[id].newer) {
+		_heap_push(rb, id);
+	}
+}
+
+static struct ringbuffer_owner *
+_owner(struct ringbuffer * rb, int id) {
+	if (id >= rb->owner_cap) {
+		int cap = rb->owner_cap * 2;
+		if (cap <= id) {
+			cap = id + 1;
+		}
+		rb->owner = realloc(rb->owner, cap * sizeof(struct ringbuffer_owner));
+		rb->heap = realloc(rb->heap, cap * sizeof(int));
+		int i;
+		for (i=rb->owner_cap;i<cap;i++) {
+			struct ringbuffer_owner * o = &rb->owner[i];
+			o->head = -1;
+			o->count = 0;
+			o->bytes = 0;
+			o->priority = 0;
+			o->heap = -1;
+			o->older = -1;
+			o->newer = -1;
+		}
+		rb->owner_cap = cap;
+	}
+	return &rb->owner[id];
+}
+
+void
+ringbuffer_priority(struct ringbuffer * rb, int id, int priority) {
+	_owner(rb, id)->priority = priority;
+	_heap_update(rb, id);
+}
+
+//take blk out of the list of its id , and set it free
+static void
+_disown(struct ringbuffer * rb, struct ringbuffer_block * blk) {
+	assert(blk->id >= 0 && blk->id < rb->owner_cap);
+	struct ringbuffer_owner * o = &rb->owner[blk->id];
+	int length = ALIGN(blk->length);
+	o->bytes -= length;
+	if (--o->count == 0) {
+		o->head = -1;
+		_owner_remove(rb, blk->id);
+	} else {
+		block_ptr(rb, blk->own_prev)->own_next = blk->own_next;
+		block_ptr(rb, blk->own_next)->own_prev = blk->own_prev;
+		if (o->head == block_offset(rb, blk)) {
+			o->head = blk->own_next;
+		}
+		_heap_update(rb, blk->id);
+	}
+	if (blk->ref > 0) {
+		blk->id = RINGBUFFER_PINNED;
+		return;
+	}
+	_use(rb, block_offset(rb, blk), -length);
+	blk->id = -1;
+}
+
+//append blk to the tail of the list of id
+void
+ringbuffer_own(struct ringbuffer * rb, struct ringbuffer_block * blk, int id) {
+	if (blk->id == id)
+		return;
+	if (blk->id >= 0) {
+		int length = ALIGN(blk->length);
+		_disown(rb, blk);
+		_use(rb, block_offset(rb, blk), length);
+	}
+	struct ringbuffer_owner * o = _owner(rb, id);
+	int offset = block_offset(rb, blk);
+	if (o->head < 0) {
+		blk->own_prev = offset;
+		blk->own_next = offset;
+		o->head = offset;
+	} else {
+		struct ringbuffer_block * first = block_ptr(rb, o->head);
+		blk->own_prev = first->own_prev;
+		blk->own_next = o->head;
+		block_ptr(rb, first->own_prev)->own_next = offset;
+		first->own_prev = offset;
+	}
+	o->bytes += ALIGN(blk->length);
+	if (o->count++ == 0) {
+		_owner_add(rb, id);
+	} else {
+		_heap_update(rb, id);
+	}
+	blk->id = id;
+}
+
 void
 ringbuffer_link(struct ringbuffer *rb , struct ringbuffer_block * head, struct ringbuffer_block * next) {
 	//head blk already have a next blk, shift to this "next blk"
@@ -63,7 +527,7 @@ ringbuffer_link(struct ringbuffer *rb , struct ringbuffer_block * head, struct r
 		head = block_ptr(rb, head->next);
 	}
 	//set 2 block of same id
-	next->id = head->id;
+	ringbuffer_own(rb, next, head->id);
     //set blk1 -> next offset of blk2
 	head->next = block_offset(rb, next);
 }
@@ -80,12 +544,20 @@ _alloc(struct ringbuffer * rb, int total_size , int size) {
 	blk->offset = 0;                                          //set length with no align ,cause padding space no need to read
 	blk->next = -1;
 	blk->id = -1;
+	blk->ref = 0;
+	rb->blocker = -1;
+	_use(rb, rb->head, align_length);
+	_lay(rb, rb->head, align_length);
+	if (rb->used > rb->peak) {
+		rb->peak = rb->used;
+	}
     //get next blk
 	struct ringbuffer_block * next = block_next(rb, blk);
 	if (next) {
 		rb->head = block_offset(rb, next);                    //set head to offset(start) of next blk
 		if (align_length < total_size) {
 			next->length = total_size - align_length;         //next blk is the remain space, set length of rest space
+			_lay(rb, rb->head, next->length);
 			if (next->length >= sizeof(struct ringbuffer_block)) {
 				next->id = -1;  //-1 means blk available
 			}
@@ -97,12 +569,46 @@ _alloc(struct ringbuffer * rb, int total_size , int size) {
 }
 
 
+//append segments to the end , and alloc size bytes from them
+static struct ringbuffer_block *
+_grow(struct ringbuffer * rb, int size) {
+	int align_length = ALIGN(sizeof(struct ringbuffer_block) + size);
+	if (rb->segment == 0 || align_length > rb->max - rb->size) {
+		return NULL;
+	}
+	int offset = rb->size;
+	while (rb->size - offset < align_length) {
+		rb->size += rb->segment;
+	}
+	if (rb->size > rb->mapped) {
+		if (mprotect(rb->base + rb->mapped, rb->size - rb->mapped, PROT_READ | PROT_WRITE) == -1) {
+			rb->size = offset;
+			return NULL;
+		}
+		rb->mapped = rb->size;
+	}
+	if (rb->populate) {
+		_populate(rb, offset, rb->size - offset);
+	}
+	struct ringbuffer_block * blk = block_ptr(rb, offset);
+	blk->length = rb->size - offset;
+	blk->id = -1;
+	_lay(rb, offset, blk->length);
+	rb->head = offset;
+	rb->idle = 0;
+	++rb->grow;
+	MREAD_DEBUG("MREAD ring buffer grow to %d\n", rb->size);
+	return _alloc(rb, blk->length, size);
+}
+
 //ring buffer alloc
 struct ringbuffer_block *
 ringbuffer_alloc(struct ringbuffer * rb, int size) {
 
     //get align size needed
 	int align_length = ALIGN(sizeof(struct ringbuffer_block) + size);
+	int head = rb->head;
+	int skip = 0;
 	int i;
 	for (i=0;i<2;i++) {
 		int free_size = 0;
@@ -112,8 +618,22 @@ ringbuffer_alloc(struct ringbuffer * rb, int size) {
                                                                     //so blk is next space to use
 		do {
             //轮转之前不会执行,只有轮转后后可能执行,轮转后遇到不可分配的,应该强行回收
-			if (blk->length >= sizeof(struct ringbuffer_block) && blk->id >= 0)    //id >= 0 means mem in use
-				return NULL;
+			if (blk->length >= sizeof(struct ringbuffer_block) && blk->id >= 0) {   //id >= 0 means mem in use
+                //step over a few blocks in use (a slow connection) before giving up , the first one is the oldest
+				if (skip == 0) {
+					rb->blocker = block_offset(rb, blk);
+				}
+				if (++skip > SKIPBLOCK) {
+					rb->head = head;
+					return _grow(rb, size);
+				}
+				free_size = 0;
+				blk = block_next(rb, blk);
+				if (blk) {
+					rb->head = block_offset(rb, blk);
+				}
+				continue;
+			}
 			free_size += ALIGN(blk->length);
 			if (free_size >= align_length) {
 				return _alloc(rb, free_size , size);
@@ -122,36 +642,179 @@ ringbuffer_alloc(struct ringbuffer * rb, int size) {
 		} while(blk);
 		rb->head = 0;    //roll back ,do again
 	}
-	return NULL;
+	rb->head = head;
+	return _grow(rb, size);
+}
+
+
+//grow the last allocated blk by size bytes in place , so the data appended stays continuous
+//return the space appended , or NULL if blk is not just before head or the free space after it is not enough
+void *
+ringbuffer_expand(struct ringbuffer * rb, struct ringbuffer_block * blk, int size) {
+	int offset = block_offset(rb, blk);
+	int old_length = ALIGN(blk->length);
+	if (offset + old_length != rb->head) {
+		return NULL;
+	}
+	int align_length = ALIGN(blk->length + size);
+	int total_size = old_length;
+	struct ringbuffer_block * next = block_next(rb, blk);
+	while (total_size < align_length) {
+		if (next == NULL || (next->length >= sizeof(struct ringbuffer_block) && next->id >= 0))
+			return NULL;
+		total_size += ALIGN(next->length);
+		next = block_next(rb, next);
+	}
+	char * ptr = (char *)blk + blk->length;
+	blk->length += size;
+	rb->blocker = -1;
+	_use(rb, offset + old_length, align_length - old_length);
+	_lay(rb, offset, align_length);
+	if (rb->used > rb->peak) {
+		rb->peak = rb->used;
+	}
+	if (blk->id >= 0) {
+		rb->owner[blk->id].bytes += align_length - old_length;
+		_heap_update(rb, blk->id);
+	}
+	next = block_next(rb, blk);
+	if (next) {
+		rb->head = block_offset(rb, next);
+		if (align_length < total_size) {
+			next->length = total_size - align_length;
+			_lay(rb, rb->head, next->length);
+			if (next->length >= sizeof(struct ringbuffer_block)) {
+				next->id = -1;
+			}
+		}
+	} else {
+		rb->head = 0;
+	}
+	return ptr;
 }
 
+//bytes not in use (or not grown yet) , they may be not continuous
+int
+ringbuffer_space(struct ringbuffer * rb) {
+	return rb->max - rb->used;
+}
 
-//return first id >0
+//give the segments at the end back to the os , if they were free at the last call too , down to min.
+//call it every idle period. return bytes released. the segments in use are counted on the fly , it doesn't walk
+int
+ringbuffer_release(struct ringbuffer * rb) {
+	if (rb->size == rb->min) {
+		return 0;
+	}
+	//the free segments at the end
+	int n = (rb->size - rb->min) / rb->segment;
+	while (n > 0 && rb->seg_used[n - 1] == 0) {
+		--n;
+	}
+	int free_size = rb->size - rb->min - n * rb->segment;
+	int release = rb->idle < free_size ? rb->idle : free_size;
+	rb->idle = free_size;
+	release = release / rb->segment * rb->segment;
+	if (release == 0) {
+		return 0;
+	}
+	rb->size -= release;
+	rb->idle -= release;
+	if (rb->populate == 2) {
+		munlock(rb->base + rb->size, release);
+	}
+	madvise(rb->base + rb->size, release, MADV_DONTNEED);
+	//the block holding the new end is free , it ends there now
+	int start = rb->seg_block[(rb->size - rb->min) / rb->segment];
+	if (start < rb->size) {
+		struct ringbuffer_block * blk = block_ptr(rb, start);
+		blk->length = rb->size - start;
+		if (blk->length >= sizeof(struct ringbuffer_block)) {
+			blk->id = -1;
+		}
+	}
+	if (rb->head >= rb->size) {
+		rb->head = start < rb->size ? start : 0;
+	}
+	rb->blocker = -1;
+	++rb->release;
+	MREAD_DEBUG("MREAD ring buffer release to %d\n", rb->size);
+	return release;
+}
+
+//the oldest is the owner of the block which stopped the last alloc , or the one owning something the longest if
+//it's unknown. the others are on top of the heap. none of them walks the buffer or the owner table
 static int
-_last_id(struct ringbuffer * rb) {
-	int i;
-	for (i=0;i<2;i++) {
-		struct ringbuffer_block * blk = block_ptr(rb, rb->head);
-		do {
-			if (blk->length >= sizeof(struct ringbuffer_block) && blk->id >= 0)
+_victim(struct ringbuffer * rb) {
+	if (rb->policy == RINGBUFFER_COLLECT_OLDEST) {
+		if (rb->blocker >= 0) {
+			struct ringbuffer_block * blk = block_ptr(rb, rb->blocker);
+			if (blk->length >= sizeof(struct ringbuffer_block) && blk->id >= 0 && blk->id != RINGBUFFER_PINNED)
 				return blk->id;
-			blk = block_next(rb, blk);
-		} while(blk);
-		rb->head = 0;
+		}
+		return rb->oldest;
+	}
+	return rb->heap_len > 0 ? rb->heap[0] : -1;
+}
+
+//the victim may not be at head , move head to the largest free run starting at one of its blocks
+static void
+_collect_head(struct ringbuffer * rb, int offset, int n) {
+	int best = -1;
+	int best_size = 0;
+	int start = 0;
+	int end = 0;
+	int i;
+	for (i=0;i<n;i++) {
+		struct ringbuffer_block * blk = block_ptr(rb, offset);
+		int next = blk->own_next;
+		if (offset < start || offset >= end) {
+			start = offset;
+			end = offset;
+			do {
+				end += ALIGN(blk->length);
+				blk = block_next(rb, blk);
+			} while (blk && (blk->length < sizeof(struct ringbuffer_block) || blk->id < 0));
+			if (end - start > best_size) {
+				best = start;
+				best_size = end - start;
+			}
+		}
+		offset = next;
+	}
+	if (best >= 0) {
+		rb->head = best;
 	}
-	return -1;
 }
 
 int
 ringbuffer_collect(struct ringbuffer * rb) {
-	int id = _last_id(rb);
-	struct ringbuffer_block *blk = block_ptr(rb, 0);
-	do {
-		if (blk->length >= sizeof(struct ringbuffer_block) && blk->id == id) {
+	int id = _victim(rb);
+	if (id < 0)
+		return -1;
+	struct ringbuffer_owner * o = &rb->owner[id];
+	MREAD_TRACE_EVENT(MREAD_TRACE_COLLECT, id, o->count);
+	int head = o->head;
+	int n = o->count;
+	int offset = head;
+	int i;
+	for (i=0;i<n;i++) {
+		struct ringbuffer_block * blk = block_ptr(rb, offset);
+		if (blk->ref > 0) {
+			blk->id = RINGBUFFER_PINNED;
+		} else {
 			blk->id = -1;
+			_use(rb, offset, -ALIGN(blk->length));
 		}
-		blk = block_next(rb, blk);
-	} while(blk);
+		offset = blk->own_next;
+	}
+	o->head = -1;
+	o->count = 0;
+	o->bytes = 0;
+	_owner_remove(rb, id);
+	if (rb->policy != RINGBUFFER_COLLECT_OLDEST) {
+		_collect_head(rb, head, n);
+	}
 	return id;
 }
 
@@ -159,7 +822,14 @@ ringbuffer_collect(struct ringbuffer * rb) {
 //shrink the bulk to given size ,left space to next blk
 void
 ringbuffer_shrink(struct ringbuffer * rb, struct ringbuffer_block * blk, int size) {
+	MREAD_TRACE_EVENT(MREAD_TRACE_SHRINK, blk->id, size);
+	rb->blocker = -1;
 	if (size == 0) {
+		if (blk->id >= 0) {
+			_disown(rb, blk);
+		} else {
+			_use(rb, block_offset(rb, blk), -ALIGN(blk->length));
+		}
 		rb->head = block_offset(rb, blk);
 		return;
 	}
@@ -167,12 +837,18 @@ ringbuffer_shrink(struct ringbuffer * rb, struct ringbuffer_block * blk, int siz
 	int old_length = ALIGN(blk->length);
 	assert(align_length <= old_length);
 	blk->length = size + sizeof(struct ringbuffer_block);
+	_use(rb, block_offset(rb, blk) + align_length, align_length - old_length);
+	if (blk->id >= 0) {
+		rb->owner[blk->id].bytes -= old_length - align_length;
+		_heap_update(rb, blk->id);
+	}
 
 	if (align_length == old_length) {
 		return;
 	}
 	blk = block_next(rb, blk);
 	blk->length = old_length - align_length;
+	_lay(rb, block_offset(rb, blk), blk->length);
 	if (blk->length >= sizeof(struct ringbuffer_block)) {
 		blk->id = -1;
 	}
@@ -193,11 +869,36 @@ ringbuffer_free(struct ringbuffer * rb, struct ringbuffer_block * blk) {
 	if (blk == NULL)
 		return;
 	int id = _block_id(blk);
-	blk->id = -1;
+	_disown(rb, blk);
 	while (blk->next >= 0) {
 		blk = block_ptr(rb, blk->next);
 		assert(_block_id(blk) == id);
+		_disown(rb, blk);
+	}
+}
+
+//pin the block of the chain from blk which holds ptr , so it's not reused after it's freed (or collected).
+//return the block to unpin , NULL if ptr is not in the chain
+struct ringbuffer_block *
+ringbuffer_pin(struct ringbuffer * rb, struct ringbuffer_block * blk, const void * ptr) {
+	for (;;) {
+		if ((const char *)ptr >= (char *)(blk + 1) && (const char *)ptr < (char *)blk + blk->length) {
+			++blk->ref;
+			return blk;
+		}
+		if (blk->next < 0)
+			return NULL;
+		blk = block_ptr(rb, blk->next);
+	}
+}
+
+void
+ringbuffer_unpin(struct ringbuffer * rb, struct ringbuffer_block * blk) {
+	assert(blk->ref > 0);
+	if (--blk->ref == 0 && blk->id == RINGBUFFER_PINNED) {
 		blk->id = -1;
+		_use(rb, block_offset(rb, blk), -ALIGN(blk->length));
+		rb->blocker = -1;
 	}
 }
 
@@ -261,7 +962,7 @@ ringbuffer_copy(struct ringbuffer * rb, struct ringbuffer_block * from, int skip
 				src =  (char *)(from + 1);
 			}
 			memcpy(ptr, src , size);    //if data length is enough ,do copy
-			to->id = from->id;      //copy id
+			ringbuffer_own(rb, to, from->id);      //copy id
 			return (char *)(to + 1);        //return dest
 		}
 		assert(from->next >= 0);        //if length is not enough to skip ,shift to next blk ,skip the left num
@@ -281,7 +982,7 @@ ringbuffer_yield(struct ringbuffer * rb, struct ringbuffer_block *blk, int skip)
 			blk->offset += skip;    //shift offset by skip ,skip means no need to process
 			return blk;
 		}
-		blk->id = -1;
+		_disown(rb, blk);
 		if (blk->next < 0) {
 			return NULL;
 		}
@@ -292,6 +993,42 @@ ringbuffer_yield(struct ringbuffer * rb, struct ringbuffer_block *blk, int skip)
 	}
 }
 
+//the counters kept on the fly , it's cheap
+void
+ringbuffer_stats(struct ringbuffer * rb, struct ringbuffer_stats * stats) {
+	stats->size = rb->size;
+	stats->max = rb->max;
+	stats->grow = rb->grow;
+	stats->release = rb->release;
+	stats->used = rb->used;
+	stats->peak = rb->peak;
+}
+
+//number of runs of free space , and the largest one (an alloc larger than it needs collect).
+//it walks all blocks , call it from the thread which uses rb only
+void
+ringbuffer_free_runs(struct ringbuffer * rb, int * free_run, int * free_max) {
+	*free_run = 0;
+	*free_max = 0;
+	int run = 0;
+	struct ringbuffer_block * blk = block_ptr(rb, 0);
+	while (blk) {
+		int length = ALIGN(blk->length);
+		if (blk->length >= sizeof(struct ringbuffer_block) && blk->id >= 0) {
+			run = 0;
+		} else {
+			if (run == 0) {
+				++*free_run;
+			}
+			run += length;
+			if (run > *free_max) {
+				*free_max = run;
+			}
+		}
+		blk = block_next(rb, blk);
+	}
+}
+
 void 
 ringbuffer_dump(struct ringbuffer * rb) {
 	struct ringbuffer_block *blk = block_ptr(rb,0);
@@ -9,28 +9,79 @@ struct ringbuffer_block {
 	int offset;		//未处理的数据块头部偏移
 	int id;
 	int next;
+	int own_prev;	//blocks of the same id are in a circular list , in alloc order
+	int own_next;
+	int ref;        //pins , a block freed while pinned stays in use (id RINGBUFFER_PINNED) until the last unpin
+};
+
+#define RINGBUFFER_PINNED 0x7fffffff
+
+//memory of ringbuffer_new_memory : transparent huge pages (MADV_HUGEPAGE) , or huge pages of the hugetlb pool
+//(MAP_HUGETLB , transparent ones when the pool is short). the sizes are rounded up to 2M
+#define RINGBUFFER_HUGEPAGE 1
+#define RINGBUFFER_HUGETLB 2
+
+#define RINGBUFFER_COLLECT_OLDEST 0
+#define RINGBUFFER_COLLECT_LARGEST 1
+#define RINGBUFFER_COLLECT_PRIORITY 2
+
+struct ringbuffer_stats {
+	int size;       //bytes in use now , min <= size <= max
+	int max;
+	int grow;       //times it grew
+	int release;    //times it gave segments back
+	int used;       //bytes of blocks in use (aligned, with the block header)
+	int peak;       //high water mark of used
 };
 
 struct ringbuffer * ringbuffer_new(int size);
 
+struct ringbuffer * ringbuffer_new_range(int size, int max, int segment);
+
+struct ringbuffer * ringbuffer_new_memory(int size, int max, int segment, int flags);
+
 void ringbuffer_delete(struct ringbuffer * rb);
 
+int ringbuffer_populate(struct ringbuffer * rb, int lock);
+
+int ringbuffer_bind(struct ringbuffer * rb, int node);
+
+void ringbuffer_policy(struct ringbuffer * rb, int policy);
+
+void ringbuffer_priority(struct ringbuffer * rb, int id, int priority);
+
+void ringbuffer_own(struct ringbuffer * rb, struct ringbuffer_block * blk, int id);
+
 void ringbuffer_link(struct ringbuffer *rb , struct ringbuffer_block * prev, struct ringbuffer_block * next);
 
 struct ringbuffer_block * ringbuffer_alloc(struct ringbuffer * rb, int size);
 
+void * ringbuffer_expand(struct ringbuffer * rb, struct ringbuffer_block * blk, int size);
+
+int ringbuffer_space(struct ringbuffer * rb);
+
+int ringbuffer_release(struct ringbuffer * rb);
+
 int ringbuffer_collect(struct ringbuffer * rb);
 
 void ringbuffer_shrink(struct ringbuffer * rb, struct ringbuffer_block * blk, int size);
 
 void ringbuffer_free(struct ringbuffer * rb, struct ringbuffer_block * blk);
 
+struct ringbuffer_block * ringbuffer_pin(struct ringbuffer * rb, struct ringbuffer_block * blk, const void * ptr);
+
+void ringbuffer_unpin(struct ringbuffer * rb, struct ringbuffer_block * blk);
+
 int ringbuffer_data(struct ringbuffer * rb, struct ringbuffer_block * blk, int size, int skip, void **ptr);
 
 void * ringbuffer_copy(struct ringbuffer * rb, struct ringbuffer_block * from, int skip, struct ringbuffer_block * to);
 
 struct ringbuffer_block * ringbuffer_yield(struct ringbuffer * rb, struct ringbuffer_block *blk, int skip);
 
+void ringbuffer_stats(struct ringbuffer * rb, struct ringbuffer_stats * stats);
+
+void ringbuffer_free_runs(struct ringbuffer * rb, int * free_run, int * free_max);
+
 void ringbuffer_dump(struct ringbuffer * rb);
 
 #endif
@@ -0,0 +1,166 @@
+#include "mread.h"
+#include "mreaddispatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define CONNS 32
+#define WORKERS 4
+#define MSGS 20000
+
+//each message is its sequence number in the connection
+struct check {
+	int next[CONNS];        //the sequence number expected
+	int running[CONNS];     //workers inside func for the connection now
+	int worker[CONNS];      //the last worker ran the connection
+	int moved;
+	int disorder;
+	int overlap;
+	int total;
+};
+
+static void
+_func(struct mread_span * span, int worker, void * ud) {
+	struct check * c = ud;
+	int id = span->id;
+	if (__atomic_add_fetch(&c->running[id], 1, __ATOMIC_SEQ_CST) != 1) {
+		__atomic_add_fetch(&c->overlap, 1, __ATOMIC_RELAXED);
+	}
+	uint32_t seq;
+	memcpy(&seq, span->data, sizeof(seq));
+	if (seq != (uint32_t)c->next[id]) {
+		__atomic_add_fetch(&c->disorder, 1, __ATOMIC_RELAXED);
+	}
+	c->next[id] = seq + 1;
+	if (c->worker[id] != worker) {
+		c->worker[id] = worker;
+		__atomic_add_fetch(&c->moved, 1, __ATOMIC_RELAXED);
+	}
+	if (seq % 7 == 0) {
+		sched_yield();
+	}
+	__atomic_add_fetch(&c->total, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&c->running[id], 1, __ATOMIC_SEQ_CST);
+}
+
+struct client {
+	int fd[CONNS];
+	int n;
+};
+
+//the connections of a client thread send round robin , a few messages each time
+static void *
+_send(void * ud) {
+	struct client * cl = ud;
+	uint32_t buffer[8];
+	int seq = 0;
+	while (seq < MSGS) {
+		int i;
+		for (i=0;i<cl->n;i++) {
+			int k;
+			for (k=0;k<8;k++) {
+				buffer[k] = seq + k;
+			}
+			if (send(cl->fd[i], buffer, sizeof(buffer), MSG_NOSIGNAL) != sizeof(buffer)) {
+				return NULL;
+			}
+		}
+		seq += 8;
+	}
+	return NULL;
+}
+
+static int
+_connect(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//every message of a connection must run in order , and on one worker at a time
+int
+main() {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.backpressure = 1;
+	opt.backlog = CONNS;
+	int port = 20000 + (getpid() + 11) % 10000;
+	struct mread_pool * m = mread_create_option(port, CONNS, 256 * 1024, &opt);
+	if (m == NULL) {
+		printf("dispatch skipped\n");
+		return 0;
+	}
+	static struct check c;
+	memset(&c, 0, sizeof(c));
+	int i;
+	for (i=0;i<CONNS;i++) {
+		c.worker[i] = -1;
+	}
+	struct mread_dispatch * d = mread_dispatch_create(CONNS, WORKERS, _func, &c);
+	if (d == NULL) {
+		printf("dispatch can't create workers\n");
+		mread_close(m);
+		return 1;
+	}
+	static struct client cl[2];
+	for (i=0;i<CONNS;i++) {
+		int fd = _connect(port);
+		if (fd < 0) {
+			printf("dispatch can't connect\n");
+			mread_dispatch_close(d);
+			mread_close(m);
+			return 1;
+		}
+		cl[i % 2].fd[cl[i % 2].n++] = fd;
+	}
+	pthread_t sender[2];
+	for (i=0;i<2;i++) {
+		pthread_create(&sender[i], NULL, _send, &cl[i]);
+	}
+	int pushed = 0;
+	time_t deadline = time(NULL) + 20;
+	while (pushed < CONNS * MSGS && time(NULL) < deadline) {
+		if (mread_poll(m, 100) < 0) {
+			continue;
+		}
+		struct mread_span * span;
+		while ((span = mread_detach(m, sizeof(uint32_t)))) {
+			mread_dispatch_push(d, span);
+			++pushed;
+			mread_yield(m);
+		}
+	}
+	mread_dispatch_close(d);
+	for (i=0;i<2;i++) {
+		pthread_join(sender[i], NULL);
+		int k;
+		for (k=0;k<cl[i].n;k++) {
+			close(cl[i].fd[k]);
+		}
+	}
+	mread_close(m);
+	int lost = 0;
+	for (i=0;i<CONNS;i++) {
+		if (c.next[i] != MSGS) {
+			++lost;
+		}
+	}
+	printf("dispatch run %d/%d disorder %d overlap %d lost %d moved %d\n", c.total, CONNS * MSGS, c.disorder, c.overlap, lost, c.moved);
+	return c.total != CONNS * MSGS || c.disorder || c.overlap || lost;
+}
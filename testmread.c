@@ -0,0 +1,1198 @@
+#include "mread.h"
+#include "mreadgroup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/un.h>
+
+#define CONNS 64
+#define MSG 64
+#define MSGS 100
+
+static int
+_connect(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//a port for each test of the run
+static int
+_port() {
+	static int next = 16;
+	return 20000 + (getpid() + next++) % 10000;
+}
+
+//every client sends whole messages and closes , each close must be reported once all its data is pulled
+static int
+test_close(const char * name, int backend, int edge_trigger) {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.backend = backend;
+	opt.edge_trigger = edge_trigger;
+	opt.backlog = CONNS;
+	int port = 20000 + (getpid() + backend * 2 + edge_trigger) % 10000;
+	struct mread_pool * m = mread_create_option(port, CONNS, 0, &opt);
+	if (m == NULL) {
+		printf("close %s skipped\n", name);
+		return 0;
+	}
+	static char buffer[MSG * MSGS];
+	memset(buffer, 1, sizeof(buffer));
+	int i;
+	for (i=0;i<CONNS;i++) {
+		int fd = _connect(port);
+		if (fd < 0 || write(fd, buffer, sizeof(buffer)) != sizeof(buffer)) {
+			printf("close %s can't connect\n", name);
+			mread_close(m);
+			return 1;
+		}
+		close(fd);
+	}
+	int closed = 0;
+	long bytes = 0;
+	time_t deadline = time(NULL) + 5;
+	while (closed < CONNS && time(NULL) < deadline) {
+		if (mread_poll(m, 100) < 0) {
+			continue;
+		}
+		for (;;) {
+			char * p = mread_pull(m, MSG);
+			if (p == NULL) {
+				if (mread_closed(m)) {
+					++closed;
+				}
+				break;
+			}
+			bytes += MSG;
+			mread_yield(m);
+		}
+	}
+	mread_close(m);
+	printf("close %s reported %d/%d bytes %s\n", name, closed, CONNS, bytes == (long)CONNS * MSG * MSGS ? "ok" : "lost");
+	return closed != CONNS || bytes != (long)CONNS * MSG * MSGS;
+}
+
+#define SPANS 1024
+
+struct spans {
+	struct mread_span * span[SPANS];
+	int n;
+};
+
+static void *
+_send(void * ud) {
+	static char buffer[256 * 1024];
+	memset(buffer, 1, sizeof(buffer));
+	send(*(int *)ud, buffer, sizeof(buffer), MSG_NOSIGNAL);
+	return NULL;
+}
+
+static void *
+_release(void * ud) {
+	struct spans * sp = ud;
+	usleep(100000);
+	int i;
+	for (i=0;i<sp->n;i++) {
+		mread_span_release(sp->span[i]);
+	}
+	return NULL;
+}
+
+static uint64_t
+_now_ms() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//the spans fill the ring buffer and backpressure pauses the client , the release by another thread must wake
+//the poll at once (without the wakeup only the timeout would end it)
+static int
+test_span() {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.backpressure = 1;
+	int port = 20000 + (getpid() + 7) % 10000;
+	struct mread_pool * m = mread_create_option(port, 4, 64 * 1024, &opt);
+	if (m == NULL) {
+		printf("span skipped\n");
+		return 0;
+	}
+	int fd = _connect(port);
+	if (fd < 0) {
+		printf("span can't connect\n");
+		mread_close(m);
+		return 1;
+	}
+	pthread_t sender;
+	pthread_create(&sender, NULL, _send, &fd);
+	static struct spans sp;
+	sp.n = 0;
+	struct mread_stats st;
+	uint64_t start = _now_ms();
+	while (_now_ms() - start < 1000 && sp.n < SPANS) {
+		if (mread_poll(m, 10) < 0) {
+			continue;
+		}
+		struct mread_span * span;
+		while (sp.n < SPANS && (span = mread_detach(m, MSG))) {
+			sp.span[sp.n++] = span;
+			mread_yield(m);
+		}
+		mread_stats(m, &st);
+		if (st.pause > 0) {
+			break;
+		}
+	}
+	pthread_t t;
+	pthread_create(&t, NULL, _release, &sp);
+	start = _now_ms();
+	mread_poll(m, 3000);
+	uint64_t wait = _now_ms() - start;
+	pthread_join(t, NULL);
+	mread_close(m);
+	pthread_join(sender, NULL);
+	close(fd);
+	printf("span paused %d woken %s\n", st.pause > 0, wait < 1000 ? "ok" : "late");
+	return st.pause == 0 || wait >= 1000;
+}
+
+#define FRAMES 400
+
+struct stream {
+	int fd;
+	char * data;
+	int size;
+};
+
+//the stream goes out in random pieces , so the frames are split across reads
+static void *
+_send_stream(void * ud) {
+	struct stream * st = ud;
+	unsigned seed = 3;
+	int off = 0;
+	while (off < st->size) {
+		int n = 1 + rand_r(&seed) % 700;
+		if (n > st->size - off) {
+			n = st->size - off;
+		}
+		if (send(st->fd, st->data + off, n, MSG_NOSIGNAL) != n) {
+			break;
+		}
+		off += n;
+		sched_yield();
+	}
+	return NULL;
+}
+
+static int
+_frame_size(unsigned * seed, int max) {
+	return rand_r(seed) % (max + 1);
+}
+
+//frames of each header size and byte order through a small ring buffer (it wraps around many times) , then a
+//frame larger than max closes the connection
+static int
+test_frame(int header, int big_endian) {
+	int max = header == 1 ? 254 : 1000;
+	int port = _port();
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.frame_header = header;
+	opt.frame_big_endian = big_endian;
+	opt.frame_max = max;
+	struct mread_pool * m = mread_create_option(port, 4, 32 * 1024, &opt);
+	if (m == NULL) {
+		printf("frame %d skipped\n", header);
+		return 0;
+	}
+	struct stream st;
+	st.data = malloc(FRAMES * (max + header) + 16);
+	st.size = 0;
+	unsigned seed = header * 2 + big_endian;
+	int k, i;
+	for (k=0;k<=FRAMES;k++) {
+        //the last one is too large
+		uint64_t len = k < FRAMES ? _frame_size(&seed, max) : max + 1;
+		for (i=0;i<header;i++) {
+			int shift = big_endian ? (header - 1 - i) * 8 : i * 8;
+			st.data[st.size++] = (char)(len >> shift);
+		}
+		if (k < FRAMES) {
+			for (i=0;i<(int)len;i++) {
+				st.data[st.size++] = (char)(k + i);
+			}
+		}
+	}
+	st.fd = _connect(port);
+	if (st.fd < 0) {
+		printf("frame %d can't connect\n", header);
+		free(st.data);
+		mread_close(m);
+		return 1;
+	}
+	int one = 1;
+	setsockopt(st.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	pthread_t t;
+	pthread_create(&t, NULL, _send_stream, &st);
+	seed = header * 2 + big_endian;
+	int frames = 0, bad = 0, closed = 0;
+	time_t deadline = time(NULL) + 10;
+	while (!closed && time(NULL) < deadline) {
+		if (mread_poll(m, 100) < 0) {
+			continue;
+		}
+		for (;;) {
+			struct mread_frame f[4];
+			int n = mread_pull_frames(m, f, 4);
+			if (n == 0) {
+				closed = mread_closed(m);
+				break;
+			}
+			for (i=0;i<n;i++) {
+				int len = _frame_size(&seed, max);
+				const char * data = f[i].data;
+				if (f[i].size != len) {
+					++bad;
+				} else {
+					int j;
+					for (j=0;j<len;j++) {
+						if (data[j] != (char)(frames + j)) {
+							++bad;
+							break;
+						}
+					}
+				}
+				++frames;
+			}
+			mread_yield(m);
+		}
+	}
+	struct mread_stats ms;
+	mread_stats(m, &ms);
+	pthread_join(t, NULL);
+	close(st.fd);
+	free(st.data);
+	mread_close(m);
+	int ok = frames == FRAMES && bad == 0 && closed && ms.reject == 1;
+	printf("frame %d%s frames %d/%d bad %d reject %d %s\n", header, big_endian ? "be" : "le", frames, FRAMES, bad,
+		(int)ms.reject, ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define SENDERS 6
+#define SENDSIZE (256 * 1024)
+
+//the byte at each offset of a stream
+static char
+_pattern(int offset) {
+	return (char)(offset % 251);
+}
+
+static char send_buffer[SENDSIZE];
+
+static void *
+_send_close(void * ud) {
+	int fd = *(int *)ud;
+	send(fd, send_buffer, SENDSIZE, MSG_NOSIGNAL);
+	close(fd);
+	return NULL;
+}
+
+//the senders push more than the ring buffer holds to a slow reader , backpressure must slow them down and never
+//collect a connection : every byte arrives and every close is reported
+static int
+test_backpressure(const char * name, int backend, int edge_trigger) {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.backend = backend;
+	opt.edge_trigger = edge_trigger;
+	opt.backpressure = 1;
+	int port = _port();
+	struct mread_pool * m = mread_create_option(port, SENDERS, 64 * 1024, &opt);
+	if (m == NULL) {
+		printf("backpressure %s skipped\n", name);
+		return 0;
+	}
+	int fd[SENDERS];
+	pthread_t t[SENDERS];
+	int i;
+	for (i=0;i<SENDERS;i++) {
+		fd[i] = _connect(port);
+		if (fd[i] < 0) {
+			printf("backpressure %s can't connect\n", name);
+			mread_close(m);
+			return 1;
+		}
+	}
+	for (i=0;i<SENDSIZE;i++) {
+		send_buffer[i] = _pattern(i);
+	}
+	for (i=0;i<SENDERS;i++) {
+		pthread_create(&t[i], NULL, _send_close, &fd[i]);
+	}
+	int offset[SENDERS];
+	memset(offset, 0, sizeof(offset));
+	int closed = 0, bad = 0;
+	long bytes = 0;
+	time_t deadline = time(NULL) + 20;
+	while (closed < SENDERS && time(NULL) < deadline) {
+		int id = mread_poll(m, 100);
+		if (id < 0) {
+			continue;
+		}
+        //one message each poll , the others keep coming meanwhile
+		const char * p = mread_pull(m, 1024);
+		if (p == NULL) {
+			if (mread_closed(m)) {
+				++closed;
+			}
+			continue;
+		}
+		for (i=0;i<1024;i++) {
+			if (p[i] != _pattern(offset[id] + i)) {
+				++bad;
+				break;
+			}
+		}
+		offset[id] += 1024;
+		bytes += 1024;
+		mread_yield(m);
+		usleep(100);
+	}
+	struct mread_stats ms;
+	mread_stats(m, &ms);
+	for (i=0;i<SENDERS;i++) {
+		pthread_join(t[i], NULL);
+	}
+	mread_close(m);
+	int ok = closed == SENDERS && bytes == (long)SENDERS * SENDSIZE && bad == 0 && ms.collect == 0;
+	printf("backpressure %s closed %d/%d bytes %ld/%ld bad %d collect %d pause %d %s\n", name, closed, SENDERS, bytes,
+		(long)SENDERS * SENDSIZE, bad, (int)ms.collect, (int)ms.pause, ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define DATAGRAMS 64
+#define DATAGRAM_MAX 1000
+
+//a burst of datagrams of any size up to max (empty ones too) to a plain udp socket and one with the source , and
+//one larger than max in the middle , which is dropped. every other datagram is a frame of its own , in order
+static int
+test_udp() {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.datagram_max = DATAGRAM_MAX;
+	struct mread_pool * m = mread_create_option(-1, 4, 0, &opt);
+	if (m == NULL) {
+		printf("udp skipped\n");
+		return 0;
+	}
+	int port[2];
+	int id[2];
+	int i;
+	for (i=0;i<2;i++) {
+		port[i] = _port();
+		id[i] = mread_udp(m, "127.0.0.1", port[i], i == 0 ? 0 : MREAD_UDP_SOURCE);
+	}
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (id[0] < 0 || id[1] < 0 || fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		printf("udp can't bind\n");
+		if (fd >= 0) {
+			close(fd);
+		}
+		mread_close(m);
+		return 1;
+	}
+	socklen_t addr_len = sizeof(addr);
+	getsockname(fd, (struct sockaddr *)&addr, &addr_len);
+	int source_port = ntohs(addr.sin_port);
+	static char buffer[DATAGRAM_MAX + 500];
+	unsigned seed = 5;
+	int k;
+	for (k=0;k<DATAGRAMS;k++) {
+		int size = _frame_size(&seed, DATAGRAM_MAX);
+		for (i=0;i<size;i++) {
+			buffer[i] = (char)(k + i);
+		}
+		for (i=0;i<2;i++) {
+			addr.sin_port = htons(port[i]);
+			sendto(fd, buffer, size, 0, (struct sockaddr *)&addr, sizeof(addr));
+			if (k == DATAGRAMS / 2 && i == 0) {
+				sendto(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&addr, sizeof(addr));
+			}
+		}
+	}
+	unsigned expect[2] = { 5, 5 };
+	int got[2] = { 0, 0 };
+	int bad = 0;
+	time_t deadline = time(NULL) + 5;
+	while ((got[0] < DATAGRAMS || got[1] < DATAGRAMS) && time(NULL) < deadline) {
+		int r = mread_poll(m, 100);
+		if (r < 0) {
+			continue;
+		}
+		int index = r == id[0] ? 0 : 1;
+		for (;;) {
+			struct mread_frame f[8];
+			int n = mread_pull_frames(m, f, 8);
+			if (n == 0) {
+				break;
+			}
+			for (k=0;k<n;k++) {
+				const char * data = f[k].data;
+				int size = f[k].size;
+				if (index == 1) {
+					struct mread_udp_source src;
+					if (size < (int)sizeof(src)) {
+						++bad;
+						continue;
+					}
+					memcpy(&src, data, sizeof(src));
+					if (src.family != AF_INET || src.port != source_port) {
+						++bad;
+					}
+					data += sizeof(src);
+					size -= sizeof(src);
+				}
+				int seq = got[index]++;
+				if (size != _frame_size(&expect[index], DATAGRAM_MAX)) {
+					++bad;
+					continue;
+				}
+				for (i=0;i<size;i++) {
+					if (data[i] != (char)(seq + i)) {
+						++bad;
+						break;
+					}
+				}
+			}
+			mread_yield(m);
+		}
+	}
+	struct mread_stats ms;
+	mread_stats(m, &ms);
+	close(fd);
+	mread_close(m);
+	int ok = got[0] == DATAGRAMS && got[1] == DATAGRAMS && bad == 0 && ms.reject == 1;
+	printf("udp datagrams %d+%d/%d bad %d reject %d %s\n", got[0], got[1], DATAGRAMS * 2, bad, (int)ms.reject,
+		ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define SENDBYTES (4 * 1024 * 1024)
+
+struct reader {
+	int fd;
+	long size;
+	long bytes;
+	int bad;
+	int done;
+};
+
+//start late , so the output fills the kernel buffer and waits for room first
+static void *
+_read_all(void * ud) {
+	struct reader * r = ud;
+	usleep(200000);
+	static char buffer[64 * 1024];
+	while (r->bytes < r->size) {
+		int n = recv(r->fd, buffer, sizeof(buffer), 0);
+		if (n <= 0) {
+			break;
+		}
+		int i;
+		for (i=0;i<n;i++) {
+			if (buffer[i] != _pattern(r->bytes + i)) {
+				++r->bad;
+				break;
+			}
+		}
+		r->bytes += n;
+	}
+	__atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+//megabytes queued by mread_send and mread_sendv to a peer which doesn't read yet , they go out by partial writes
+//as the peer drains them , each byte once and in order
+static int
+test_send(const char * name, int backend) {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.backend = backend;
+	int port = _port();
+	struct mread_pool * m = mread_create_option(port, 4, 0, &opt);
+	if (m == NULL) {
+		printf("send %s skipped\n", name);
+		return 0;
+	}
+	struct reader r;
+	memset(&r, 0, sizeof(r));
+	r.fd = _connect(port);
+	r.size = SENDBYTES;
+	if (r.fd < 0 || send(r.fd, "x", 1, 0) != 1) {
+		printf("send %s can't connect\n", name);
+		mread_close(m);
+		return 1;
+	}
+	int id = -1;
+	time_t deadline = time(NULL) + 10;
+	while (id < 0 && time(NULL) < deadline) {
+		id = mread_poll(m, 100);
+	}
+	mread_pull(m, 1);
+	mread_yield(m);
+	char * data = malloc(SENDBYTES);
+	int i;
+	for (i=0;i<SENDBYTES;i++) {
+		data[i] = _pattern(i);
+	}
+	unsigned seed = 7;
+	int off = 0;
+	while (off < SENDBYTES) {
+		int n = 1 + rand_r(&seed) % (64 * 1024);
+		if (n > SENDBYTES - off) {
+			n = SENDBYTES - off;
+		}
+		if (n & 1) {
+			mread_send(m, id, data + off, n);
+		} else {
+			struct iovec iov[2];
+			iov[0].iov_base = data + off;
+			iov[0].iov_len = n / 2;
+			iov[1].iov_base = data + off + n / 2;
+			iov[1].iov_len = n - n / 2;
+			mread_sendv(m, id, iov, 2);
+		}
+		off += n;
+	}
+	pthread_t t;
+	pthread_create(&t, NULL, _read_all, &r);
+	while (!__atomic_load_n(&r.done, __ATOMIC_ACQUIRE) && time(NULL) < deadline) {
+		mread_poll(m, 10);
+	}
+	struct mread_stats ms;
+	mread_stats(m, &ms);
+	shutdown(r.fd, SHUT_RDWR);
+	pthread_join(t, NULL);
+	close(r.fd);
+	free(data);
+	mread_close(m);
+	int ok = r.bytes == SENDBYTES && r.bad == 0 && ms.send_bytes == SENDBYTES;
+	printf("send %s bytes %ld/%d bad %d writes %d %s\n", name, r.bytes, SENDBYTES, r.bad, (int)ms.send,
+		ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define FORWARDBYTES (4 * 1024 * 1024)
+
+struct forward_stream {
+	int fd;
+	int from;
+	int to;
+};
+
+static void *
+_send_range(void * ud) {
+	struct forward_stream * st = ud;
+	static char buffer[64 * 1024];
+	int off = st->from;
+	while (off < st->to) {
+		int n = st->to - off < (int)sizeof(buffer) ? st->to - off : (int)sizeof(buffer);
+		int i;
+		for (i=0;i<n;i++) {
+			buffer[i] = _pattern(off + i);
+		}
+		if (send(st->fd, buffer, n, MSG_NOSIGNAL) != n) {
+			break;
+		}
+		off += n;
+	}
+	return NULL;
+}
+
+//the stream goes to a socketpair which is read late , so forwarding is blocked and the client paused for a while.
+//the part buffered and not pulled goes first , and after fd -1 stops it the data is pulled from the pool again
+static int
+test_forward(const char * name, int edge_trigger) {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.edge_trigger = edge_trigger;
+	int port = _port();
+	struct mread_pool * m = mread_create_option(port, 4, 0, &opt);
+	if (m == NULL) {
+		printf("forward %s skipped\n", name);
+		return 0;
+	}
+	int pair[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+	fcntl(pair[1], F_SETFL, O_NONBLOCK);
+	struct forward_stream st;
+	st.fd = _connect(port);
+	st.from = 16;
+	st.to = FORWARDBYTES;
+	char head[16];
+	int i;
+	for (i=0;i<16;i++) {
+		head[i] = _pattern(i);
+	}
+	if (st.fd < 0 || send(st.fd, head, 16, 0) != 16) {
+		printf("forward %s can't connect\n", name);
+		mread_close(m);
+		return 1;
+	}
+	int id = -1;
+	const char * p = NULL;
+	time_t deadline = time(NULL) + 10;
+	while (p == NULL && time(NULL) < deadline) {
+		id = mread_poll(m, 100);
+		if (id >= 0) {
+			p = mread_pull(m, 8);
+		}
+	}
+	int bad = p == NULL || memcmp(p, head, 8) != 0;
+	if (mread_forward(m, id, pair[1], 0) != 0) {
+		printf("forward %s failed\n", name);
+		mread_close(m);
+		return 1;
+	}
+	pthread_t t;
+	pthread_create(&t, NULL, _send_range, &st);
+	struct reader r;
+	memset(&r, 0, sizeof(r));
+	r.fd = pair[0];
+	r.size = FORWARDBYTES;
+	r.bytes = 8;
+	pthread_t rt;
+	pthread_create(&rt, NULL, _read_all, &r);
+	while (!__atomic_load_n(&r.done, __ATOMIC_ACQUIRE) && time(NULL) < deadline) {
+		mread_poll(m, 10);
+	}
+	pthread_join(t, NULL);
+	pthread_join(rt, NULL);
+	mread_forward(m, id, -1, 0);
+	char tail[1024];
+	for (i=0;i<(int)sizeof(tail);i++) {
+		tail[i] = _pattern(FORWARDBYTES + i);
+	}
+	send(st.fd, tail, sizeof(tail), 0);
+	close(st.fd);
+	int pulled = 0, closed = 0;
+	while (!closed && time(NULL) < deadline) {
+		if (mread_poll(m, 100) != id) {
+			continue;
+		}
+		for (;;) {
+			p = mread_pull(m, 256);
+			if (p == NULL) {
+				closed = mread_closed(m);
+				break;
+			}
+			if (pulled + 256 > (int)sizeof(tail) || memcmp(p, tail + pulled, 256) != 0) {
+				++bad;
+			}
+			pulled += 256;
+			mread_yield(m);
+		}
+	}
+	char c;
+	int leak = recv(pair[0], &c, 1, MSG_DONTWAIT) > 0;
+	struct mread_stats ms;
+	mread_stats(m, &ms);
+	close(pair[0]);
+	close(pair[1]);
+	mread_close(m);
+	int ok = r.bytes == FORWARDBYTES && r.bad == 0 && !bad && pulled == sizeof(tail) && closed && !leak &&
+		ms.forward == FORWARDBYTES - 8;
+	printf("forward %s bytes %ld/%d bad %d pulled %d closed %d %s\n", name, r.bytes, FORWARDBYTES, r.bad + bad,
+		pulled, closed, ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define BATCHCONNS 8
+
+//mread_poll_batch returns every ready id , an id pulled half is returned again by the next batch , and the ids
+//closed by mread_close_client come first in the batch after
+static int
+test_batch(const char * name, int backend, int edge_trigger) {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.backend = backend;
+	opt.edge_trigger = edge_trigger;
+	int port = _port();
+	struct mread_pool * m = mread_create_option(port, BATCHCONNS * 2, 0, &opt);
+	if (m == NULL) {
+		printf("batch %s skipped\n", name);
+		return 0;
+	}
+	int fd[BATCHCONNS];
+	char buffer[64];
+	int i, k;
+	for (i=0;i<BATCHCONNS;i++) {
+		fd[i] = _connect(port);
+		memset(buffer, i, sizeof(buffer));
+		if (fd[i] < 0 || send(fd[i], buffer, sizeof(buffer), 0) != sizeof(buffer)) {
+			printf("batch %s can't connect\n", name);
+			mread_close(m);
+			return 1;
+		}
+	}
+    //client of each id , and the bytes pulled from it
+	int client[BATCHCONNS * 2];
+	int pulled[BATCHCONNS * 2];
+	memset(client, -1, sizeof(client));
+	memset(pulled, 0, sizeof(pulled));
+	int bad = 0, again = 0, done = 0;
+	int ids[BATCHCONNS * 2];
+	time_t deadline = time(NULL) + 5;
+	while (done < BATCHCONNS && time(NULL) < deadline) {
+		int n = mread_poll_batch(m, ids, BATCHCONNS * 2, 100);
+		for (k=0;k<n;k++) {
+			int id = ids[k];
+			if (mread_select(m, id) != 0) {
+				++bad;
+				continue;
+			}
+			if (pulled[id] > 0) {
+				++again;
+			}
+            //half of it the first time
+			const char * p = mread_pull(m, 32);
+			if (p == NULL) {
+				continue;
+			}
+			if (client[id] < 0) {
+				client[id] = p[0];
+			}
+			for (i=0;i<32;i++) {
+				if (p[i] != client[id]) {
+					++bad;
+					break;
+				}
+			}
+			pulled[id] += 32;
+			if (pulled[id] == 64) {
+				++done;
+			}
+			mread_yield(m);
+		}
+	}
+	if (mread_select(m, BATCHCONNS * 2 - 1) != -1) {
+		++bad;
+	}
+    //close three , and the others send again
+	int closed_id[3];
+	int c = 0;
+	for (i=0;i<BATCHCONNS * 2 && c < 3;i++) {
+		if (client[i] >= 0) {
+			closed_id[c++] = i;
+			mread_close_client(m, i);
+		}
+	}
+	for (i=0;i<BATCHCONNS;i++) {
+		send(fd[i], buffer, 1, MSG_NOSIGNAL);
+	}
+	usleep(10000);
+	int n = mread_poll_batch(m, ids, BATCHCONNS * 2, 100);
+	int first = n >= 3;
+	for (k=0;k<n;k++) {
+		mread_select(m, ids[k]);
+		int closed = mread_closed(m);
+		if (k < 3 && (ids[k] != closed_id[k] || !closed)) {
+			first = 0;
+		}
+	}
+	for (i=0;i<BATCHCONNS;i++) {
+		close(fd[i]);
+	}
+	mread_close(m);
+    //the closed ones and the others all in one batch
+	int ok = done == BATCHCONNS && again == BATCHCONNS && bad == 0 && first && n == BATCHCONNS;
+	printf("batch %s ready %d/%d again %d bad %d closed first %d next %d %s\n", name, done, BATCHCONNS, again, bad,
+		first, n, ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define REUSECONNS 4
+
+//connect a client for each free id of a full pool , return the number accepted and their ids
+static int
+_accept_all(struct mread_pool * m, int port, int * fd, int * ids) {
+	int i;
+	for (i=0;i<REUSECONNS;i++) {
+		fd[i] = _connect(port);
+		if (fd[i] < 0 || send(fd[i], "x", 1, 0) != 1) {
+			return 0;
+		}
+	}
+	int n = 0;
+	time_t deadline = time(NULL) + 5;
+	while (n < REUSECONNS && time(NULL) < deadline) {
+		int id = mread_poll(m, 100);
+		if (id >= 0 && mread_pull(m, 1)) {
+			ids[n++] = id;
+			mread_yield(m);
+		}
+	}
+	return n;
+}
+
+//mread_closed_batch takes the closed ids in the order they are closed and frees them , so a full pool accepts
+//again on the same ids. a handle of the client before is stale then
+static int
+test_reuse() {
+	int port = _port();
+	struct mread_pool * m = mread_create(port, REUSECONNS, 0);
+	if (m == NULL) {
+		printf("reuse skipped\n");
+		return 0;
+	}
+	int fd[REUSECONNS];
+	int ids[REUSECONNS];
+	uint64_t handle[REUSECONNS];
+	int ok = _accept_all(m, port, fd, ids) == REUSECONNS;
+	int closed[REUSECONNS * 2];
+	ok = ok && mread_closed_batch(m, closed, REUSECONNS * 2) == 0;
+	int i;
+	for (i=0;i<REUSECONNS;i++) {
+		handle[i] = mread_handle(m, ids[i]);
+		ok = ok && mread_handle_id(m, handle[i]) == ids[i];
+		mread_close_client(m, ids[i]);
+		close(fd[i]);
+	}
+	ok = ok && mread_closed_batch(m, closed, REUSECONNS * 2) == REUSECONNS;
+	for (i=0;i<REUSECONNS;i++) {
+		ok = ok && closed[i] == ids[i] && mread_handle_id(m, handle[i]) == -1;
+	}
+	int reused[REUSECONNS];
+	ok = ok && _accept_all(m, port, fd, reused) == REUSECONNS;
+	for (i=0;i<REUSECONNS;i++) {
+		int k;
+		int found = 0;
+		for (k=0;k<REUSECONNS;k++) {
+			if (reused[i] == ids[k]) {
+				found = 1;
+				ok = ok && mread_handle_id(m, handle[k]) == -1 && mread_handle(m, reused[i]) != handle[k];
+			}
+		}
+		ok = ok && found && mread_handle_id(m, mread_handle(m, reused[i])) == reused[i];
+		close(fd[i]);
+	}
+	struct mread_stats ms;
+	mread_stats(m, &ms);
+	mread_close(m);
+	ok = ok && ms.refuse == 0;
+	printf("reuse %s\n", ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define SHARDS 4
+
+struct group_count {
+	int msgs;
+	int closed;
+};
+
+static void
+_shard(struct mread_pool * m, int shard, void * ud) {
+	struct group_count * c = ud;
+	if (mread_poll(m, 10) < 0) {
+		return;
+	}
+	for (;;) {
+		if (mread_pull(m, MSG) == NULL) {
+			if (mread_closed(m)) {
+				__atomic_add_fetch(&c->closed, 1, __ATOMIC_RELAXED);
+			}
+			return;
+		}
+		__atomic_add_fetch(&c->msgs, 1, __ATOMIC_RELAXED);
+		mread_yield(m);
+	}
+}
+
+//the shards of a group share the port by SO_REUSEPORT , each runs its own thread. the clients are spread over
+//more than one of them , and every message and close arrives once
+static int
+test_group() {
+	int port = _port();
+	struct mread_group * g = mread_group_create(port, SHARDS, CONNS, 0);
+	if (g == NULL) {
+		printf("group skipped\n");
+		return 0;
+	}
+	struct group_count c;
+	memset(&c, 0, sizeof(c));
+	if (mread_group_start(g, _shard, &c) != 0) {
+		printf("group can't start\n");
+		mread_group_close(g);
+		return 1;
+	}
+	static char buffer[MSG * MSGS];
+	memset(buffer, 1, sizeof(buffer));
+	int i;
+	for (i=0;i<CONNS;i++) {
+		int fd = _connect(port);
+		if (fd >= 0) {
+			send(fd, buffer, sizeof(buffer), MSG_NOSIGNAL);
+			close(fd);
+		}
+	}
+	time_t deadline = time(NULL) + 5;
+	while (__atomic_load_n(&c.closed, __ATOMIC_RELAXED) < CONNS && time(NULL) < deadline) {
+		usleep(10000);
+	}
+	mread_group_stop(g);
+	int used = 0;
+	for (i=0;i<mread_group_size(g);i++) {
+		struct mread_stats st;
+		mread_stats(mread_group_pool(g, i), &st);
+		if (st.accept > 0) {
+			++used;
+		}
+	}
+	struct mread_group_stats gs;
+	mread_group_stats(g, &gs);
+	mread_group_close(g);
+	int ok = c.msgs == CONNS * MSGS && c.closed == CONNS && used > 1 && gs.shard == SHARDS &&
+		gs.total.accept == CONNS && gs.total.connection == 0;
+	printf("group msgs %d/%d closed %d/%d shards used %d/%d %s\n", c.msgs, CONNS * MSGS, c.closed, CONNS, used,
+		SHARDS, ok ? "ok" : "failed");
+	return !ok;
+}
+
+#define KINDS 5
+
+//connect to a listener of the kind (v4 , v6 , unix path , abstract , inherited fd) , port or name
+static int
+_connect_kind(int kind, int port, const char * name) {
+	struct sockaddr_storage ss;
+	memset(&ss, 0, sizeof(ss));
+	socklen_t len;
+	int family;
+	if (kind == 1) {
+		struct sockaddr_in6 * in6 = (struct sockaddr_in6 *)&ss;
+		in6->sin6_family = family = AF_INET6;
+		in6->sin6_port = htons(port);
+		in6->sin6_addr = in6addr_loopback;
+		len = sizeof(*in6);
+	} else if (kind == 2 || kind == 3) {
+		struct sockaddr_un * un = (struct sockaddr_un *)&ss;
+		un->sun_family = family = AF_UNIX;
+		strcpy(un->sun_path, name);
+		len = sizeof(*un);
+		if (kind == 3) {
+			un->sun_path[0] = '\0';
+			len = offsetof(struct sockaddr_un, sun_path) + strlen(name);
+		}
+	} else {
+		struct sockaddr_in * in = (struct sockaddr_in *)&ss;
+		in->sin_family = family = AF_INET;
+		in->sin_port = htons(port);
+		in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		len = sizeof(*in);
+	}
+	int fd = socket(family, SOCK_STREAM, 0);
+	if (connect(fd, (struct sockaddr *)&ss, len) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//two listeners of each kind in one pool , a client on each tells the index it connects to , mread_listener must
+//report the same
+static int
+test_listen(const char * name, int backend) {
+	struct mread_option opt;
+	memset(&opt, 0, sizeof(opt));
+	opt.backend = backend;
+	struct mread_pool * m = mread_create_option(-1, KINDS * 2, 0, &opt);
+	if (m == NULL) {
+		printf("listen %s skipped\n", name);
+		return 0;
+	}
+	int port[KINDS * 2];
+	char path[KINDS * 2][64];
+	int i;
+	for (i=0;i<KINDS * 2;i++) {
+		int kind = i % KINDS;
+		port[i] = _port();
+		int index = -1;
+		if (kind == 0) {
+			index = mread_listen(m, "127.0.0.1", port[i], 0);
+		} else if (kind == 1) {
+			index = mread_listen(m, "::1", port[i], 0);
+		} else if (kind == 2) {
+			snprintf(path[i], sizeof(path[i]), "/tmp/testmread-%d-%d.sock", (int)getpid(), i);
+			index = mread_listen(m, path[i], 0, 0);
+		} else if (kind == 3) {
+			snprintf(path[i], sizeof(path[i]), "@testmread-%d-%d", (int)getpid(), i);
+			index = mread_listen(m, path[i], 0, 0);
+		} else {
+            //bound by someone else
+			struct sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(port[i]);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			int fd = socket(AF_INET, SOCK_STREAM, 0);
+			if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(fd, 8) == 0) {
+				index = mread_listen_fd(m, fd, 0);
+			}
+			if (index < 0) {
+				close(fd);
+			}
+		}
+		if (index != i) {
+			printf("listen %s can't add listener %d\n", name, i);
+			mread_close(m);
+			return 1;
+		}
+	}
+	int fd[KINDS * 2];
+	for (i=0;i<KINDS * 2;i++) {
+		fd[i] = _connect_kind(i % KINDS, port[i], path[i]);
+		char c = i;
+		if (fd[i] < 0 || send(fd[i], &c, 1, 0) != 1) {
+			printf("listen %s can't connect to %d\n", name, i);
+			mread_close(m);
+			return 1;
+		}
+	}
+	int got = 0, bad = 0;
+	time_t deadline = time(NULL) + 5;
+	while (got < KINDS * 2 && time(NULL) < deadline) {
+		int id = mread_poll(m, 100);
+		if (id < 0) {
+			continue;
+		}
+		const char * p = mread_pull(m, 1);
+		if (p == NULL) {
+			continue;
+		}
+		if (mread_listener(m, id) != p[0]) {
+			++bad;
+		}
+		++got;
+		mread_yield(m);
+	}
+	for (i=0;i<KINDS * 2;i++) {
+		close(fd[i]);
+	}
+	mread_close(m);
+	int removed = access(path[2], F_OK) == -1 && access(path[2 + KINDS], F_OK) == -1;
+	int ok = got == KINDS * 2 && bad == 0 && removed;
+	printf("listen %s accepted %d/%d bad %d removed %d %s\n", name, got, KINDS * 2, bad, removed, ok ? "ok" : "failed");
+	return !ok;
+}
+
+//the socket file of a live server is never replaced , one left by a dead one is , and no other file ever is
+static int
+test_unix_path() {
+	struct mread_pool * m = mread_create(-1, 4, 0);
+	struct mread_pool * other = mread_create(-1, 4, 0);
+	if (m == NULL || other == NULL) {
+		printf("unix path skipped\n");
+		mread_close(m);
+		mread_close(other);
+		return 0;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/testmread-%d.sock", (int)getpid());
+	int ok = mread_listen(m, path, 0, 0) == 0;
+    //live : the second pool fails , the first still accepts on it
+	ok = ok && mread_listen(other, path, 0, 0) == -1;
+	int fd = _connect_kind(2, 0, path);
+	ok = ok && fd >= 0 && send(fd, "x", 1, 0) == 1;
+    //the probe of the second pool is accepted too , it sends nothing
+	const char * p = NULL;
+	time_t deadline = time(NULL) + 5;
+	while (ok && p == NULL && time(NULL) < deadline) {
+		if (mread_poll(m, 100) >= 0) {
+			p = mread_pull(m, 1);
+			if (p == NULL) {
+				mread_closed(m);
+			}
+		}
+	}
+	ok = ok && p != NULL;
+	if (fd >= 0) {
+		close(fd);
+	}
+	mread_close(m);
+    //stale : a socket file nobody listens on
+	struct sockaddr_un un;
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strcpy(un.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	ok = ok && bind(fd, (struct sockaddr *)&un, sizeof(un)) == 0;
+	close(fd);
+	ok = ok && mread_listen(other, path, 0, 0) == 0;
+	mread_close(other);
+    //not a socket
+	fd = open(path, O_CREAT | O_WRONLY, 0600);
+	close(fd);
+	other = mread_create(-1, 4, 0);
+	ok = ok && other && mread_listen(other, path, 0, 0) == -1 && access(path, F_OK) == 0;
+	mread_close(other);
+	unlink(path);
+	printf("unix path %s\n", ok ? "ok" : "failed");
+	return !ok;
+}
+
+int
+main() {
+	int fail = 0;
+	fail += test_close("poll", MREAD_BACKEND_POLL, 0);
+	fail += test_close("poll-et", MREAD_BACKEND_POLL, 1);
+	fail += test_close("io_uring", MREAD_BACKEND_URING, 0);
+	fail += test_span();
+	fail += test_backpressure("poll", MREAD_BACKEND_POLL, 0);
+	fail += test_backpressure("poll-et", MREAD_BACKEND_POLL, 1);
+	fail += test_backpressure("io_uring", MREAD_BACKEND_URING, 0);
+	int header;
+	for (header=1;header<=8;header*=2) {
+		fail += test_frame(header, 0);
+		fail += test_frame(header, 1);
+	}
+	fail += test_udp();
+	fail += test_send("poll", MREAD_BACKEND_POLL);
+	fail += test_send("io_uring", MREAD_BACKEND_URING);
+	fail += test_forward("poll", 0);
+	fail += test_forward("poll-et", 1);
+	fail += test_batch("poll", MREAD_BACKEND_POLL, 0);
+	fail += test_batch("poll-et", MREAD_BACKEND_POLL, 1);
+	fail += test_batch("io_uring", MREAD_BACKEND_URING, 0);
+	fail += test_reuse();
+	fail += test_group();
+	fail += test_listen("poll", MREAD_BACKEND_POLL);
+	fail += test_listen("io_uring", MREAD_BACKEND_URING);
+	fail += test_unix_path();
+	return fail != 0;
+}
@@ -1,5 +1,7 @@
 #include "ringbuffer.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static void
 init(struct ringbuffer_block * blk, int n) {
@@ -26,25 +28,34 @@ dump(struct ringbuffer * rb, struct ringbuffer_block *blk, int size) {
 	}
 }
 
+static void
+stats(struct ringbuffer * rb) {
+	struct ringbuffer_stats st;
+	ringbuffer_stats(rb, &st);
+	int free_run, free_max;
+	ringbuffer_free_runs(rb, &free_run, &free_max);
+	printf("size=%d used=%d peak=%d free_run=%d free_max=%d\n", st.size, st.used, st.peak, free_run, free_max);
+}
+
 static void
 test(struct ringbuffer *rb) {
 	struct ringbuffer_block * blk;
 	blk = ringbuffer_alloc(rb,48);
-	blk->id = 0;
+	ringbuffer_own(rb, blk, 0);
 	ringbuffer_free(rb,blk);
 	blk = ringbuffer_alloc(rb,48);
-	blk->id = 1;
+	ringbuffer_own(rb, blk, 1);
 	ringbuffer_free(rb,blk);
 
 	blk = ringbuffer_alloc(rb,80);
-	blk->id = 0;
+	ringbuffer_own(rb, blk, 0);
 	ringbuffer_free(rb,blk);
 
 
 	blk = ringbuffer_alloc(rb,50);
-	blk->id = 1;
+	ringbuffer_own(rb, blk, 1);
 	struct ringbuffer_block * next = ringbuffer_alloc(rb, 4);
-	next->id = 1;
+	ringbuffer_own(rb, next, 1);
 	ringbuffer_link(rb, blk, next);
 	ringbuffer_dump(rb);
 
@@ -55,7 +66,7 @@ test(struct ringbuffer *rb) {
 	printf("collect %d\n",id);
 
 	blk = ringbuffer_alloc(rb,4);
-	blk->id = 2;
+	ringbuffer_own(rb, blk, 2);
 	init(blk,4);
 
 	next = ringbuffer_alloc(rb,5);
@@ -81,12 +92,614 @@ test(struct ringbuffer *rb) {
 	blk = ringbuffer_yield(rb, blk , 5);
 
 	ringbuffer_dump(rb);
+	stats(rb);
+}
+
+static void
+test_expand(struct ringbuffer *rb) {
+	struct ringbuffer_block * blk = ringbuffer_alloc(rb,8);
+	ringbuffer_own(rb, blk, 0);
+	init(blk,8);
+	char * ptr = ringbuffer_expand(rb, blk, 8);
+	printf("expand %d\n", ptr == (char *)(blk+1) + 8);
+	int i;
+	for (i=0;i<8;i++) {
+		ptr[i] = i + 9;
+	}
+	dump(rb,blk,16);
+	struct ringbuffer_block * next = ringbuffer_alloc(rb,8);
+	ringbuffer_own(rb, next, 1);
+	printf("expand blocked %d\n", ringbuffer_expand(rb, blk, 8) == NULL);
+	ringbuffer_free(rb,next);
+	printf("expand too large %d\n", ringbuffer_expand(rb, blk, 128) == NULL);
+	stats(rb);
+	ringbuffer_free(rb,blk);
+}
+
+static void
+test_grow(struct ringbuffer *rb) {
+	struct ringbuffer_block * blk[8];
+	int i;
+	for (i=0;i<8;i++) {
+		blk[i] = ringbuffer_alloc(rb, 1500);
+		ringbuffer_own(rb, blk[i], i);
+	}
+	struct ringbuffer_stats st;
+	ringbuffer_stats(rb, &st);
+	printf("grow size=%d max=%d grow=%d used=%d\n", st.size, st.max, st.grow, st.used);
+	printf("grow full %d\n", ringbuffer_alloc(rb, 8192) == NULL);
+	for (i=2;i<8;i++) {
+		ringbuffer_free(rb, blk[i]);
+	}
+	printf("release %d\n", ringbuffer_release(rb));
+	printf("release %d\n", ringbuffer_release(rb));
+	ringbuffer_stats(rb, &st);
+	printf("release size=%d release=%d used=%d\n", st.size, st.release, st.used);
+	blk[2] = ringbuffer_alloc(rb, 1500);
+	printf("alloc %d\n", blk[2] != NULL);
+	ringbuffer_own(rb, blk[2], 2);
+	for (i=0;i<3;i++) {
+		ringbuffer_free(rb, blk[i]);
+	}
+	stats(rb);
+}
+
+//huge pages , bound and faulted in : the sizes are rounded up to 2M , a grown segment is faulted in too
+static void
+test_memory(struct ringbuffer *rb) {
+	ringbuffer_bind(rb, -1);
+	ringbuffer_populate(rb, 0);
+	struct ringbuffer_stats st;
+	ringbuffer_stats(rb, &st);
+	printf("memory size=%d max=%d\n", st.size, st.max);
+	int n = 0;
+	struct ringbuffer_block * blk;
+	while ((blk = ringbuffer_alloc(rb, 65536)) != NULL) {
+		ringbuffer_own(rb, blk, n++);
+		memset(blk + 1, n, 65536);
+	}
+	ringbuffer_stats(rb, &st);
+	printf("memory blocks=%d size=%d grow=%d\n", n, st.size, st.grow);
+	while ((n = ringbuffer_collect(rb)) >= 0)
+		;
+	ringbuffer_release(rb);
+	ringbuffer_release(rb);
+	ringbuffer_stats(rb, &st);
+	printf("memory size=%d release=%d used=%d\n", st.size, st.release, st.used);
+}
+
+static void
+test_policy(struct ringbuffer *rb, int policy) {
+	int i;
+	ringbuffer_policy(rb, policy);
+	ringbuffer_priority(rb, 1, -1);
+	for (i=0;;i++) {
+		struct ringbuffer_block * blk = ringbuffer_alloc(rb, 8 + (i % 3) * 8);
+		if (blk == NULL)
+			break;
+		ringbuffer_own(rb, blk, i % 3);
+	}
+	int id = ringbuffer_collect(rb);
+	printf("policy %d collect %d\n", policy, id);
+	struct ringbuffer_block * blk = ringbuffer_alloc(rb, 8);
+	printf("%s\n", blk ? "alloc" : "full");
+	stats(rb);
+}
+
+//the reference model of test_random : each id is a stream of bytes [r , w) kept in a chain of blocks
+#define IDS 16
+#define CHAIN 64
+#define READSIZE 512
+#define ALIGN(s) (((s) + sizeof(int) - 1) & ~(sizeof(int) - 1))
+
+struct model {
+	struct ringbuffer_block * blk[CHAIN];
+	int size[CHAIN];    //data bytes of each block
+	int n;
+	int offset;         //bytes consumed of the first block
+	unsigned r;
+	unsigned w;
+	int priority;
+};
+
+static struct model M[IDS];
+static int errors;
+
+//pinned blocks , an orphan one is freed by its id (pos and size are its bytes then) and kept until unpinned
+#define PINS 32
+
+struct pin {
+	struct ringbuffer_block * blk;
+	int ref;
+	int orphan;
+	int id;
+	unsigned pos;
+	int size;
+};
+
+static struct pin P[PINS];
+static int npin;
+
+static void
+error(const char * what, int id, int op) {
+	if (++errors <= 10) {
+		printf("random error %s id %d op %d\n", what, id, op);
+	}
+}
+
+static char
+byte(int id, unsigned pos) {
+	return (char)(id * 31 + pos * 7 + (pos >> 8));
+}
+
+static int
+model_bytes(int id) {
+	int bytes = 0;
+	int i;
+	for (i=0;i<M[id].n;i++) {
+		bytes += ALIGN(sizeof(struct ringbuffer_block) + M[id].size[i]);
+	}
+	return bytes;
+}
+
+static int
+model_used() {
+	int used = 0;
+	int i;
+	for (i=0;i<IDS;i++) {
+		used += model_bytes(i);
+	}
+	for (i=0;i<npin;i++) {
+		if (P[i].orphan) {
+			used += ALIGN(sizeof(struct ringbuffer_block) + P[i].size);
+		}
+	}
+	return used;
+}
+
+static struct pin *
+model_pin(struct ringbuffer_block * blk) {
+	int i;
+	for (i=0;i<npin;i++) {
+		if (P[i].blk == blk)
+			return &P[i];
+	}
+	return NULL;
+}
+
+//the block j of id is freed , pos is the stream position of its first byte
+static void
+model_drop(int id, int j, unsigned pos) {
+	struct pin * p = model_pin(M[id].blk[j]);
+	if (p) {
+		p->orphan = 1;
+		p->id = id;
+		p->pos = pos;
+		p->size = M[id].size[j];
+	}
+}
+
+static void
+model_clear(int id) {
+	struct model * m = &M[id];
+	unsigned pos = m->r - m->offset;
+	int i;
+	for (i=0;i<m->n;i++) {
+		model_drop(id, i, pos);
+		pos += m->size[i];
+	}
+	m->n = 0;
+	m->offset = 0;
+	m->r = m->w;
+}
+
+//a new block [blk , blk+length) must not overlap any block in use
+static void
+check_overlap(struct ringbuffer_block * blk, int length, int op) {
+	char * begin = (char *)blk;
+	int i,j;
+	for (i=0;i<IDS;i++) {
+		for (j=0;j<M[i].n;j++) {
+			char * b = (char *)M[i].blk[j];
+			if (b == begin)
+				continue;
+			if (begin < b + ALIGN(sizeof(struct ringbuffer_block) + M[i].size[j]) && b < begin + length) {
+				error("overlap", i, op);
+			}
+		}
+	}
+	for (i=0;i<npin;i++) {
+		char * b = (char *)P[i].blk;
+		if (P[i].orphan && begin < b + ALIGN(sizeof(struct ringbuffer_block) + P[i].size) && b < begin + length) {
+			error("overlap pinned", P[i].id, op);
+		}
+	}
+}
+
+//the victim of collect by the policy , the oldest one is only known to own something
+static void
+check_collect(int id, int policy, int op) {
+	int expect = -1;
+	int i;
+	for (i=0;i<IDS;i++) {
+		if (M[i].n == 0)
+			continue;
+		if (expect < 0 || policy == RINGBUFFER_COLLECT_OLDEST) {
+			if (expect < 0)
+				expect = i;
+			continue;
+		}
+		if (policy == RINGBUFFER_COLLECT_PRIORITY && M[i].priority != M[expect].priority) {
+			if (M[i].priority < M[expect].priority) {
+				expect = i;
+			}
+		} else if (model_bytes(i) > model_bytes(expect)) {
+			expect = i;
+		}
+	}
+	if (expect < 0 ? id >= 0 : (id < 0 || M[id].n == 0)) {
+		error("collect nothing", id, op);
+	} else if (policy != RINGBUFFER_COLLECT_OLDEST && id != expect) {
+		error("collect victim", id, op);
+	}
+	if (id >= 0) {
+		model_clear(id);
+	}
+}
+
+//alloc like mread does , collect until it fits. return NULL if id itself is collected
+static struct ringbuffer_block *
+alloc(struct ringbuffer * rb, int id, int size, int policy, int op) {
+	struct ringbuffer_block * blk;
+	while ((blk = ringbuffer_alloc(rb, size)) == NULL) {
+		int victim = ringbuffer_collect(rb);
+		check_collect(victim, policy, op);
+		if (victim < 0 || victim == id)
+			return NULL;
+	}
+	check_overlap(blk, ALIGN(sizeof(struct ringbuffer_block) + size), op);
+	return blk;
+}
+
+//recv n bytes into the tail (expanded) or into a new block
+static void
+op_append(struct ringbuffer * rb, int id, int policy, int op) {
+	struct model * m = &M[id];
+	int n = rand() % 4 ? rand() % 64 : rand() % (READSIZE + 1);
+	if (m->n > 0 && rand() % 2) {
+		struct ringbuffer_block * tail = m->blk[m->n-1];
+		char * ptr = ringbuffer_expand(rb, tail, READSIZE);
+		if (ptr) {
+			int length = m->size[m->n-1];
+			if (ptr != (char *)(tail + 1) + length) {
+				error("expand", id, op);
+			}
+			check_overlap(tail, ALIGN(sizeof(struct ringbuffer_block) + length + READSIZE), op);
+			int i;
+			for (i=0;i<n;i++) {
+				ptr[i] = byte(id, m->w + i);
+			}
+			ringbuffer_shrink(rb, tail, length + n);
+			m->size[m->n-1] += n;
+			m->w += n;
+			return;
+		}
+	}
+	if (m->n == CHAIN)
+		return;
+	struct ringbuffer_block * blk = alloc(rb, id, READSIZE, policy, op);
+	if (blk == NULL)
+		return;
+	char * ptr = (char *)(blk + 1);
+	int i;
+	for (i=0;i<n;i++) {
+		ptr[i] = byte(id, m->w + i);
+	}
+	ringbuffer_shrink(rb, blk, n);
+	if (n == 0)
+		return;
+	if (m->n > 0) {
+		ringbuffer_link(rb, m->blk[m->n-1], blk);
+	} else {
+		ringbuffer_own(rb, blk, id);
+	}
+	m->blk[m->n] = blk;
+	m->size[m->n] = n;
+	++m->n;
+	m->w += n;
+}
+
+//ringbuffer_data points into the block only if [skip , skip+size) is in one block , else copy into a temp
+static void
+op_read(struct ringbuffer * rb, int id, int policy, int op) {
+	struct model * m = &M[id];
+	int avail = m->w - m->r;
+	int skip = rand() % (avail + 1);
+	int size = avail == skip ? 1 : rand() % (avail - skip) + 1;
+	if (rand() % 8 == 0) {
+		size += avail - skip;
+	}
+	int expect = size < avail - skip ? size : avail - skip;
+	int contiguous = 0;
+	int i;
+	int pos = skip + m->offset;
+	for (i=0;i<m->n;i++) {
+		if (pos < m->size[i]) {
+			contiguous = m->size[i] - pos >= size;
+			break;
+		}
+		pos -= m->size[i];
+	}
+	void * buffer;
+	int ret = ringbuffer_data(rb, m->blk[0], size, skip, &buffer);
+	if (ret != expect || (buffer != NULL) != contiguous) {
+		error("data", id, op);
+		return;
+	}
+	struct ringbuffer_block * temp = NULL;
+	if (buffer == NULL) {
+		if (ret < size)
+			return;
+		temp = alloc(rb, id, size, policy, op);
+		if (temp == NULL)
+			return;
+		buffer = ringbuffer_copy(rb, m->blk[0], skip, temp);
+		if (buffer != temp + 1 || temp->id != id) {
+			error("copy", id, op);
+		}
+	}
+	char * ptr = buffer;
+	for (i=0;i<size;i++) {
+		if (ptr[i] != byte(id, m->r + skip + i)) {
+			error("content", id, op);
+			break;
+		}
+	}
+	ringbuffer_free(rb, temp);
+}
+
+static void
+op_yield(struct ringbuffer * rb, int id, int op) {
+	struct model * m = &M[id];
+	int skip = rand() % (m->w - m->r + 1);
+	struct ringbuffer_block * blk = ringbuffer_yield(rb, m->blk[0], skip);
+	unsigned pos = m->r - m->offset;
+	m->r += skip;
+	skip += m->offset;
+	while (m->n > 0 && skip >= m->size[0]) {
+		model_drop(id, 0, pos);
+		pos += m->size[0];
+		skip -= m->size[0];
+		--m->n;
+		memmove(m->blk, m->blk + 1, m->n * sizeof(m->blk[0]));
+		memmove(m->size, m->size + 1, m->n * sizeof(m->size[0]));
+	}
+	m->offset = m->n > 0 ? skip : 0;
+	if (blk != (m->n > 0 ? m->blk[0] : NULL) || (blk && blk->offset != m->offset)) {
+		error("yield", id, op);
+	}
+}
+
+//pin a byte of a random block of id , or unpin one
+static void
+op_pin(struct ringbuffer * rb, int id, int op) {
+	struct model * m = &M[id];
+	if (npin > 0 && (npin == PINS || m->n == 0 || rand() % 2)) {
+		struct pin * p = &P[rand() % npin];
+		ringbuffer_unpin(rb, p->blk);
+		if (--p->ref == 0) {
+			*p = P[--npin];
+		}
+		return;
+	}
+	if (m->n == 0)
+		return;
+	int j = rand() % m->n;
+	char * ptr = (char *)(m->blk[j] + 1) + rand() % m->size[j];
+	struct ringbuffer_block * blk = ringbuffer_pin(rb, m->blk[0], ptr);
+	if (blk != m->blk[j]) {
+		error("pin", id, op);
+		return;
+	}
+	struct pin * p = model_pin(blk);
+	if (p == NULL) {
+		p = &P[npin++];
+		p->blk = blk;
+		p->ref = 0;
+		p->orphan = 0;
+	}
+	++p->ref;
+}
+
+//every block of every id is checked in place : the header and the bytes
+static void
+check_all(int op) {
+	int i,j,k;
+	for (i=0;i<IDS;i++) {
+		struct model * m = &M[i];
+		unsigned pos = m->r - m->offset;
+		for (j=0;j<m->n;j++) {
+			struct ringbuffer_block * blk = m->blk[j];
+			if (blk->length != sizeof(struct ringbuffer_block) + m->size[j] || blk->id != i) {
+				error("block", i, op);
+			}
+			char * ptr = (char *)(blk + 1);
+			for (k=j ? 0 : m->offset;k<m->size[j];k++) {
+				if (ptr[k] != byte(i, pos + k)) {
+					error("block content", i, op);
+					break;
+				}
+			}
+			pos += m->size[j];
+		}
+	}
+	for (i=0;i<npin;i++) {
+		struct pin * p = &P[i];
+		if (!p->orphan)
+			continue;
+		if (p->blk->id != RINGBUFFER_PINNED || p->blk->length != sizeof(struct ringbuffer_block) + p->size) {
+			error("pinned block", p->id, op);
+		}
+		char * ptr = (char *)(p->blk + 1);
+		for (k=0;k<p->size;k++) {
+			if (ptr[k] != byte(p->id, p->pos + k)) {
+				error("pinned content", p->id, op);
+				break;
+			}
+		}
+	}
+}
+
+//walk the layout from the first block : the lengths cover size exactly , and the blocks in use are the model's
+static void
+check_layout(struct ringbuffer * rb, char * base, int op) {
+	struct ringbuffer_stats st;
+	ringbuffer_stats(rb, &st);
+	int count = 0;
+	int offset = 0;
+	while (offset < st.size) {
+		struct ringbuffer_block * blk = (struct ringbuffer_block *)(base + offset);
+		int length = ALIGN(blk->length);
+		if (blk->length <= 0 || length > st.size - offset) {
+			error("layout", -1, op);
+			return;
+		}
+		if (blk->length >= sizeof(struct ringbuffer_block) && blk->id == RINGBUFFER_PINNED) {
+			struct pin * p = model_pin(blk);
+			if (p == NULL || !p->orphan) {
+				error("stray pinned", -1, op);
+			}
+			--count;
+		} else if (blk->length >= sizeof(struct ringbuffer_block) && blk->id >= 0) {
+			int i;
+			for (i=0;i<M[blk->id % IDS].n;i++) {
+				if (M[blk->id % IDS].blk[i] == blk)
+					break;
+			}
+			if (blk->id >= IDS || i == M[blk->id].n) {
+				error("stray block", blk->id, op);
+			}
+			++count;
+		}
+		offset += length;
+	}
+	int i;
+	for (i=0;i<IDS;i++) {
+		count -= M[i].n;
+	}
+	for (i=0;i<npin;i++) {
+		if (P[i].orphan) {
+			++count;
+		}
+	}
+	if (count != 0) {
+		error("lost block", -1, op);
+	}
+}
+
+//random operations in the way mread uses them , checked against the model after each one
+static int
+test_random(struct ringbuffer * rb, int ops) {
+	memset(M, 0, sizeof(M));
+	npin = 0;
+	errors = 0;
+    //the first alloc of a new ring buffer is at offset 0
+	struct ringbuffer_block * first = ringbuffer_alloc(rb, 0);
+	char * base = (char *)first;
+	ringbuffer_shrink(rb, first, 0);
+	int policy = RINGBUFFER_COLLECT_OLDEST;
+	int op;
+	for (op=0;op<ops;op++) {
+		int id = rand() % IDS;
+		int r = rand() % 100;
+		if (rand() % 16 == 0) {
+			op_pin(rb, id, op);
+		} else if (M[id].n == 0 || r < 40) {
+            //a few recvs in a row , as an edge triggered drain does
+			int n = rand() % 3 + 1;
+			while (n-- > 0) {
+				op_append(rb, id, policy, op);
+			}
+		} else if (r < 65) {
+			op_read(rb, id, policy, op);
+		} else if (r < 88) {
+			op_yield(rb, id, op);
+		} else if (r < 93) {
+			ringbuffer_free(rb, M[id].blk[0]);
+			model_clear(id);
+		} else if (r < 96) {
+			check_collect(ringbuffer_collect(rb), policy, op);
+		} else if (r < 98) {
+			M[id].priority = rand() % 3 - 1;
+			ringbuffer_priority(rb, id, M[id].priority);
+		} else if (r < 99) {
+			ringbuffer_release(rb);
+		} else {
+			policy = rand() % 3;
+			ringbuffer_policy(rb, policy);
+		}
+		struct ringbuffer_stats st;
+		ringbuffer_stats(rb, &st);
+		if (st.used != model_used() || st.used > st.size || st.peak < st.used) {
+			error("used", id, op);
+		}
+		if (op % 64 == 0) {
+			check_layout(rb, base, op);
+		}
+		if (op % 1024 == 0) {
+			check_all(op);
+		}
+	}
+	check_all(op);
+	check_layout(rb, base, op);
+	for (op=0;op<IDS;op++) {
+		if (M[op].n > 0) {
+			ringbuffer_free(rb, M[op].blk[0]);
+		}
+	}
+	for (op=0;op<npin;op++) {
+		while (P[op].ref-- > 0) {
+			ringbuffer_unpin(rb, P[op].blk);
+		}
+	}
+	struct ringbuffer_stats st;
+	ringbuffer_stats(rb, &st);
+	int free_run, free_max;
+	ringbuffer_free_runs(rb, &free_run, &free_max);
+	if (st.used != 0 || free_run != 1 || free_max != st.size) {
+		error("leak", -1, ops);
+	}
+	printf("random ops %d errors %d\n", ops, errors);
+	return errors;
 }
 
 int
-main() {
-	struct ringbuffer * rb = ringbuffer_new(128);
+main(int argc, char * argv[]) {
+	struct ringbuffer * rb = ringbuffer_new(140);
 	test(rb);
 	ringbuffer_delete(rb);
-	return 0;
+	rb = ringbuffer_new(128);
+	test_expand(rb);
+	ringbuffer_delete(rb);
+	rb = ringbuffer_new_range(4096, 16384, 4096);
+	test_grow(rb);
+	ringbuffer_delete(rb);
+	rb = ringbuffer_new_memory(4096, 6 * 1024 * 1024, 0, RINGBUFFER_HUGEPAGE);
+	test_memory(rb);
+	ringbuffer_delete(rb);
+	int i;
+	for (i=RINGBUFFER_COLLECT_OLDEST;i<=RINGBUFFER_COLLECT_PRIORITY;i++) {
+		rb = ringbuffer_new(256);
+		test_policy(rb, i);
+		ringbuffer_delete(rb);
+	}
+	int ops = argc > 1 ? atoi(argv[1]) : 1000000;
+	srand(1);
+	rb = ringbuffer_new(8192);
+	int fail = test_random(rb, ops);
+	ringbuffer_delete(rb);
+	rb = ringbuffer_new_range(8192, 32768, 4096);
+	fail += test_random(rb, ops);
+	ringbuffer_delete(rb);
+	return fail != 0;
 }
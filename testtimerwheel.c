@@ -0,0 +1,93 @@
+#include "timerwheel.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX 1000
+
+//each timer pops at the first step not before its expire
+static int
+test_order(struct timerwheel * tw) {
+	uint64_t expire[] = { 1005, 1000, 1300, 1000 + 70000, 1001, 1000 + 5000000 };
+	int n = sizeof(expire) / sizeof(expire[0]);
+	int i;
+	for (i=0;i<n;i++) {
+		timerwheel_add(tw, i, expire[i]);
+	}
+	timerwheel_del(tw, 4);
+	printf("count %d next %d\n", timerwheel_count(tw), timerwheel_next(tw, 1000));
+	uint64_t now;
+	int wrong = 0;
+	for (now = 1000; timerwheel_count(tw) > 0; now += 1000) {
+		int id;
+		while ((id = timerwheel_expire(tw, now)) >= 0) {
+			printf("expire %d at %d (%d)\n", id, (int)now, (int)expire[id]);
+			if (id == 4 || expire[id] > now || expire[id] + 1000 <= now) {
+				++wrong;
+			}
+		}
+	}
+	return wrong;
+}
+
+//random timers against a plain array : none expires early , none is left after its expire
+static int
+test_random(struct timerwheel * tw, uint64_t now) {
+	static uint64_t expire[MAX];
+	int i;
+	for (i=0;i<MAX;i++) {
+		expire[i] = 0;
+	}
+	int early = 0, late = 0, popped = 0, lost = 0;
+	int round;
+	for (round=0;round<20000;round++) {
+		int id = rand() % MAX;
+		switch (rand() % 4) {
+		case 0:
+			expire[id] = 0;
+			timerwheel_del(tw, id);
+			break;
+		case 1:
+			expire[id] = now + rand() % (1 << (rand() % 24)) + 1;
+			timerwheel_add(tw, id, expire[id]);
+			break;
+		default:
+			now += rand() % 2 ? rand() % 16 : rand() % 70000;
+			while ((id = timerwheel_expire(tw, now)) >= 0) {
+				if (expire[id] == 0 || expire[id] > now) {
+					++early;
+				}
+				expire[id] = 0;
+				++popped;
+			}
+			for (i=0;i<MAX;i++) {
+				if (expire[i] && expire[i] <= now) {
+					++late;
+				}
+				if (expire[i] && timerwheel_get(tw, i) != expire[i]) {
+					++lost;
+				}
+			}
+			int next = timerwheel_next(tw, now);
+			for (i=0;i<MAX;i++) {
+				if (expire[i] && (next < 0 || expire[i] < now + next)) {
+					++late;
+				}
+			}
+			break;
+		}
+	}
+	printf("random popped %d early %d late %d lost %d\n", popped > 0, early, late, lost);
+	return popped == 0 || early || late || lost;
+}
+
+int
+main() {
+	struct timerwheel * tw = timerwheel_new(MAX, 1000);
+	int fail = test_order(tw);
+	timerwheel_delete(tw);
+	srand(1);
+	tw = timerwheel_new(MAX, 0xfffff000);
+	fail += test_random(tw, 0xfffff000);
+	timerwheel_delete(tw);
+	return fail != 0;
+}
@@ -0,0 +1,276 @@
+#include "timerwheel.h"
+#include <stdlib.h>
+#include <string.h>
+
+//the near slots are the next 256 ticks , each level above covers 64 times the one below it
+#define NEAR_SHIFT 8
+#define NEAR (1 << NEAR_SHIFT)
+#define NEAR_MASK (NEAR - 1)
+#define LEVEL_SHIFT 6
+#define LEVEL (1 << LEVEL_SHIFT)
+#define LEVEL_MASK (LEVEL - 1)
+#define LEVELS 4
+//a timer further than it is moved in
+#define MAXSPAN ((uint64_t)1 << (NEAR_SHIFT + LEVELS * LEVEL_SHIFT))
+
+//the slot of a timer not in the wheel , and the list of the expired ones not popped yet
+#define SLOT_NONE -1
+#define SLOT_DUE (NEAR + LEVELS * LEVEL)
+
+struct timer_node {
+	uint64_t expire;
+	int prev;
+	int next;
+	int slot;
+};
+
+struct timerwheel {
+	uint64_t time;     //the last tick done , the slots of the later ticks are pending
+	int max;
+	int count;         //timers in the wheel , the due ones included
+	uint64_t near_bits[NEAR / 64];   //the near slots not empty , find the next one without a walk
+	int head[SLOT_DUE + 1];          //the near slots , the levels , and the due list
+	struct timer_node * node;
+};
+
+struct timerwheel *
+timerwheel_new(int max, uint64_t now) {
+	struct timerwheel * tw = malloc(sizeof(*tw));
+	if (tw == NULL) {
+		return NULL;
+	}
+	tw->node = malloc(max * sizeof(struct timer_node));
+	if (tw->node == NULL) {
+		free(tw);
+		return NULL;
+	}
+	tw->time = now;
+	tw->max = max;
+	tw->count = 0;
+	memset(tw->near_bits, 0, sizeof(tw->near_bits));
+	int i;
+	for (i=0;i<=SLOT_DUE;i++) {
+		tw->head[i] = -1;
+	}
+	for (i=0;i<max;i++) {
+		tw->node[i].expire = 0;
+		tw->node[i].prev = -1;
+		tw->node[i].next = -1;
+		tw->node[i].slot = SLOT_NONE;
+	}
+	return tw;
+}
+
+void
+timerwheel_delete(struct timerwheel * tw) {
+	if (tw == NULL)
+		return;
+	free(tw->node);
+	free(tw);
+}
+
+static void
+_link(struct timerwheel * tw, int id, int slot) {
+	struct timer_node * n = &tw->node[id];
+	n->slot = slot;
+	n->prev = -1;
+	n->next = tw->head[slot];
+	if (n->next >= 0) {
+		tw->node[n->next].prev = id;
+	}
+	tw->head[slot] = id;
+	if (slot < NEAR) {
+		tw->near_bits[slot >> 6] |= (uint64_t)1 << (slot & 63);
+	}
+}
+
+static void
+_unlink(struct timerwheel * tw, int id) {
+	struct timer_node * n = &tw->node[id];
+	if (n->prev >= 0) {
+		tw->node[n->prev].next = n->next;
+	} else {
+		tw->head[n->slot] = n->next;
+		if (n->slot < NEAR && n->next < 0) {
+			tw->near_bits[n->slot >> 6] &= ~((uint64_t)1 << (n->slot & 63));
+		}
+	}
+	if (n->next >= 0) {
+		tw->node[n->next].prev = n->prev;
+	}
+	n->slot = SLOT_NONE;
+}
+
+//the slot of the lowest level which the expire shares the higher bits with the time
+static void
+_place(struct timerwheel * tw, int id) {
+	uint64_t expire = tw->node[id].expire;
+	uint64_t time = tw->time;
+	if (expire <= time) {
+		_link(tw, id, SLOT_DUE);
+		return;
+	}
+	if ((expire | NEAR_MASK) == (time | NEAR_MASK)) {
+		_link(tw, id, (int)(expire & NEAR_MASK));
+		return;
+	}
+	int i;
+	int shift = NEAR_SHIFT;
+	for (i=0;i<LEVELS-1;i++) {
+		uint64_t mask = ((uint64_t)1 << (shift + LEVEL_SHIFT)) - 1;
+		if ((expire | mask) == (time | mask)) {
+			break;
+		}
+		shift += LEVEL_SHIFT;
+	}
+	_link(tw, id, NEAR + i * LEVEL + (int)((expire >> shift) & LEVEL_MASK));
+}
+
+//detach a slot , then put its timers again by the current time
+static void
+_move(struct timerwheel * tw, int slot) {
+	int id = tw->head[slot];
+	tw->head[slot] = -1;
+	if (slot < NEAR) {
+		tw->near_bits[slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+	}
+	while (id >= 0) {
+		int next = tw->node[id].next;
+		_place(tw, id);
+		id = next;
+	}
+}
+
+//the time crossed a near window , bring the slot of the next window down from the levels
+static void
+_cascade(struct timerwheel * tw) {
+	int i;
+	int shift = NEAR_SHIFT;
+	for (i=0;i<LEVELS;i++) {
+		int index = (int)((tw->time >> shift) & LEVEL_MASK);
+		if (index != 0 || i == LEVELS - 1) {
+			_move(tw, NEAR + i * LEVEL + index);
+			break;
+		}
+		shift += LEVEL_SHIFT;
+	}
+}
+
+//the first near slot not empty from slot , -1 if there is none till the end of the window
+static int
+_near_next(struct timerwheel * tw, int slot) {
+	int i = slot >> 6;
+	uint64_t bits = tw->near_bits[i] & (~(uint64_t)0 << (slot & 63));
+	for (;;) {
+		if (bits) {
+			return i * 64 + __builtin_ctzll(bits);
+		}
+		if (++i == NEAR / 64) {
+			return -1;
+		}
+		bits = tw->near_bits[i];
+	}
+}
+
+//the next tick to do : a near slot not empty , or the start of the next window
+static uint64_t
+_next_tick(struct timerwheel * tw) {
+	uint64_t t = tw->time + 1;
+	if ((t & NEAR_MASK) == 0) {
+		return t;
+	}
+	int slot = _near_next(tw, (int)(t & NEAR_MASK));
+	if (slot < 0) {
+		return (t | NEAR_MASK) + 1;
+	}
+	return (t & ~(uint64_t)NEAR_MASK) | slot;
+}
+
+//move the time forward by the ticks which have nothing to do , up to now
+static void
+_advance(struct timerwheel * tw, uint64_t now) {
+	uint64_t t = _next_tick(tw);
+	if (t > now) {
+		tw->time = now;
+		return;
+	}
+	tw->time = t;
+	if ((t & NEAR_MASK) == 0) {
+		_cascade(tw);
+	}
+	_move(tw, (int)(t & NEAR_MASK));
+}
+
+//set (or move) the timer of id
+void
+timerwheel_add(struct timerwheel * tw, int id, uint64_t expire) {
+	struct timer_node * n = &tw->node[id];
+	if (n->slot != SLOT_NONE) {
+		_unlink(tw, id);
+	} else {
+		++tw->count;
+	}
+	if (expire > tw->time && expire - tw->time >= MAXSPAN) {
+		expire = tw->time + MAXSPAN - 1;
+	}
+	n->expire = expire;
+	_place(tw, id);
+}
+
+void
+timerwheel_del(struct timerwheel * tw, int id) {
+	if (tw->node[id].slot != SLOT_NONE) {
+		_unlink(tw, id);
+		--tw->count;
+	}
+}
+
+//the expire of id , 0 if it has no timer
+uint64_t
+timerwheel_get(struct timerwheel * tw, int id) {
+	struct timer_node * n = &tw->node[id];
+	return n->slot == SLOT_NONE ? 0 : n->expire;
+}
+
+//pop one timer expired at now , -1 if there is none. the timer is removed
+int
+timerwheel_expire(struct timerwheel * tw, uint64_t now) {
+	for (;;) {
+		int id = tw->head[SLOT_DUE];
+		if (id >= 0) {
+			_unlink(tw, id);
+			--tw->count;
+			return id;
+		}
+		if (tw->time >= now) {
+			return -1;
+		}
+		if (tw->count == 0) {
+			tw->time = now;
+			return -1;
+		}
+		_advance(tw, now);
+	}
+}
+
+//ticks from now to the next expire , or to the next cascade when only the far ones are left (it's the time to check
+//again , not later than any expire). 0 if some are due , -1 if there is no timer
+int
+timerwheel_next(struct timerwheel * tw, uint64_t now) {
+	if (tw->count == 0) {
+		return -1;
+	}
+	if (tw->head[SLOT_DUE] >= 0) {
+		return 0;
+	}
+	uint64_t t = _next_tick(tw);
+	if (t <= now) {
+		return 0;
+	}
+	return t - now > 0x7fffffff ? 0x7fffffff : (int)(t - now);
+}
+
+int
+timerwheel_count(struct timerwheel * tw) {
+	return tw->count;
+}
@@ -0,0 +1,25 @@
+#ifndef MREAD_TIMERWHEEL_H
+#define MREAD_TIMERWHEEL_H
+
+#include <stdint.h>
+
+//one timer for each id in [0,max) , the time is in ticks (ms)
+struct timerwheel;
+
+struct timerwheel * timerwheel_new(int max, uint64_t now);
+
+void timerwheel_delete(struct timerwheel * tw);
+
+void timerwheel_add(struct timerwheel * tw, int id, uint64_t expire);
+
+void timerwheel_del(struct timerwheel * tw, int id);
+
+uint64_t timerwheel_get(struct timerwheel * tw, int id);
+
+int timerwheel_expire(struct timerwheel * tw, uint64_t now);
+
+int timerwheel_next(struct timerwheel * tw, uint64_t now);
+
+int timerwheel_count(struct timerwheel * tw);
+
+#endif
@@ -0,0 +1,283 @@
+#ifdef __linux__
+
+#include "uring.h"
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+//a minimal io_uring wrapper (raw syscalls, no liburing) for one submitter thread
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+struct uring {
+	int fd;
+	int disabled;                    //created disabled , enabled by the first submitter thread
+	unsigned sq_entries;
+	unsigned cq_entries;
+    //submission queue
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned sq_local;               //sqes filled but not submitted yet
+	struct io_uring_sqe * sqes;
+    //completion queue
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_cqe * cqes;
+	void * sq_ring;
+	size_t sq_ring_size;
+	void * cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+    //provided buffer ring
+	struct io_uring_buf_ring * br;
+	size_t br_size;
+	unsigned br_mask;
+	unsigned short br_tail;
+	char * buffer;
+	int buffer_size;
+};
+
+static int
+_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void * arg, size_t argsz) {
+	return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+static int
+_setup(int entries, int cq_entries, unsigned flags, struct io_uring_params * p) {
+	memset(p, 0, sizeof(*p));
+	p->flags = IORING_SETUP_CQSIZE | flags;
+	p->cq_entries = cq_entries;
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+//the ring is created on one thread and may be driven by another (mread_group),
+//so it starts disabled and the single issuer is bound when it is enabled
+static void
+_enable(struct uring * ur) {
+	if (ur->disabled) {
+		ur->disabled = 0;
+		syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0);
+	}
+}
+
+struct uring *
+uring_new(int entries, int cq_entries) {
+	struct io_uring_params p;
+    //defer task run : completions are only posted inside uring_wait , not while the caller handles a batch
+	int disabled = 1;
+	int fd = _setup(entries, cq_entries, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED, &p);
+	if (fd < 0) {
+		disabled = 0;
+		fd = _setup(entries, cq_entries, 0, &p);
+		if (fd < 0) {
+			return NULL;
+		}
+	}
+	struct uring * ur = malloc(sizeof(*ur));
+	memset(ur, 0, sizeof(*ur));
+	ur->fd = fd;
+	ur->disabled = disabled;
+	ur->sq_entries = p.sq_entries;
+	ur->cq_entries = p.cq_entries;
+
+	ur->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_size > ur->sq_ring_size)
+			ur->sq_ring_size = ur->cq_ring_size;
+		ur->cq_ring_size = ur->sq_ring_size;
+	}
+	ur->sq_ring = mmap(NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED) {
+		goto _error;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ur->cq_ring = mmap(NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ur->cq_ring == MAP_FAILED) {
+			ur->cq_ring = NULL;
+			goto _error;
+		}
+	}
+	ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) {
+		ur->sqes = NULL;
+		goto _error;
+	}
+
+	char * sq = ur->sq_ring;
+	ur->sq_head = (unsigned *)(sq + p.sq_off.head);
+	ur->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ur->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ur->sq_array = (unsigned *)(sq + p.sq_off.array);
+	ur->sq_local = *ur->sq_tail;
+
+	char * cq = ur->cq_ring;
+	ur->cq_head = (unsigned *)(cq + p.cq_off.head);
+	ur->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ur->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return ur;
+_error:
+	if (ur->sq_ring != MAP_FAILED) {
+		uring_delete(ur);
+	} else {
+		close(fd);
+		free(ur);
+	}
+	return NULL;
+}
+
+void
+uring_delete(struct uring * ur) {
+	if (ur->br) {
+		munmap(ur->br, ur->br_size);
+	}
+	free(ur->buffer);
+	if (ur->sqes) {
+		munmap(ur->sqes, ur->sqes_size);
+	}
+	if (ur->cq_ring && ur->cq_ring != ur->sq_ring) {
+		munmap(ur->cq_ring, ur->cq_ring_size);
+	}
+	munmap(ur->sq_ring, ur->sq_ring_size);
+	close(ur->fd);
+	free(ur);
+}
+
+//return a cleared sqe , submit the queued ones first when the ring is full
+struct io_uring_sqe *
+uring_sqe(struct uring * ur) {
+	unsigned head = load_acquire(ur->sq_head);
+	if (ur->sq_local - head >= ur->sq_entries) {
+		_enable(ur);
+		unsigned n = ur->sq_local - *ur->sq_tail;
+		store_release(ur->sq_tail, ur->sq_local);
+		_enter(ur->fd, n, 0, 0, NULL, 0);
+		head = load_acquire(ur->sq_head);
+		if (ur->sq_local - head >= ur->sq_entries) {
+			return NULL;
+		}
+	}
+	unsigned index = ur->sq_local & *ur->sq_mask;
+	struct io_uring_sqe * sqe = &ur->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ur->sq_array[index] = index;
+	++ur->sq_local;
+	return sqe;
+}
+
+//submit queued sqes and wait (timeout in milliseconds, -1 for indefinitely) for at least one cqe.
+//return number of cqes ready, -1 for error
+int
+uring_wait(struct uring * ur, int timeout) {
+	_enable(ur);
+	unsigned submit = ur->sq_local - *ur->sq_tail;
+	store_release(ur->sq_tail, ur->sq_local);
+	unsigned ready = load_acquire(ur->cq_tail) - *ur->cq_head;
+	int r;
+	if (ready > 0) {
+		if (submit == 0) {
+			return ready;
+		}
+		r = _enter(ur->fd, submit, 0, 0, NULL, 0);
+	} else if (timeout == 0) {
+        //GETEVENTS without waiting, it runs the deferred task work
+		r = _enter(ur->fd, submit, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+	} else if (timeout < 0) {
+		r = _enter(ur->fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	} else {
+		struct __kernel_timespec ts;
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		struct io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (unsigned long)&ts;
+		r = _enter(ur->fd, submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+	if (r < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+		return -1;
+	}
+	return load_acquire(ur->cq_tail) - *ur->cq_head;
+}
+
+struct io_uring_cqe *
+uring_cqe(struct uring * ur) {
+	unsigned head = *ur->cq_head;
+	if (head == load_acquire(ur->cq_tail)) {
+		return NULL;
+	}
+	return &ur->cqes[head & *ur->cq_mask];
+}
+
+void
+uring_cqe_seen(struct uring * ur) {
+	store_release(ur->cq_head, *ur->cq_head + 1);
+}
+
+//register count (power of 2) buffers of size bytes as provided buffer group
+int
+uring_buffer_init(struct uring * ur, int group, int count, int size) {
+	ur->br_size = count * sizeof(struct io_uring_buf);
+	void * br = mmap(NULL, ur->br_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (br == MAP_FAILED) {
+		return -1;
+	}
+	ur->br = br;
+	ur->br_mask = count - 1;
+	ur->br_tail = 0;
+	ur->buffer = malloc(count * size);
+	if (ur->buffer == NULL) {
+		munmap(br, ur->br_size);
+		ur->br = NULL;
+		return -1;
+	}
+	ur->buffer_size = size;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)br;
+	reg.ring_entries = count;
+	reg.bgid = group;
+	if (syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		munmap(br, ur->br_size);
+		ur->br = NULL;
+		free(ur->buffer);
+		ur->buffer = NULL;
+		return -1;
+	}
+	int i;
+	for (i=0;i<count;i++) {
+		uring_buffer_recycle(ur, i);
+	}
+	return 0;
+}
+
+char *
+uring_buffer(struct uring * ur, int bid) {
+	return ur->buffer + bid * ur->buffer_size;
+}
+
+//give the buffer back to the kernel
+void
+uring_buffer_recycle(struct uring * ur, int bid) {
+	struct io_uring_buf * buf = &ur->br->bufs[ur->br_tail & ur->br_mask];
+	buf->addr = (unsigned long)(ur->buffer + bid * ur->buffer_size);
+	buf->len = ur->buffer_size;
+	buf->bid = bid;
+	++ur->br_tail;
+	store_release(&ur->br->tail, ur->br_tail);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef MREAD_URING_H
+#define MREAD_URING_H
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+
+struct uring;
+
+struct uring * uring_new(int entries, int cq_entries);
+
+void uring_delete(struct uring * ur);
+
+struct io_uring_sqe * uring_sqe(struct uring * ur);
+
+int uring_wait(struct uring * ur, int timeout);
+
+struct io_uring_cqe * uring_cqe(struct uring * ur);
+
+void uring_cqe_seen(struct uring * ur);
+
+int uring_buffer_init(struct uring * ur, int group, int count, int size);
+
+char * uring_buffer(struct uring * ur, int bid);
+
+void uring_buffer_recycle(struct uring * ur, int bid);
+
+#endif
+
+#endif